@@ -0,0 +1,53 @@
+#!/usr/bin/env bash
+#
+# Typed array kernels over 10^6 elements, each run 200 times, against
+# foldl + over a Q-Expression of the same numbers. Throughput is the bytes
+# of array data read per second, so it can be compared with memory
+# bandwidth. Each run subtracts the time to build the inputs.
+#
+#   usage: bench/arrays.sh [path/to/rosq]
+
+ROSQ=${1:-./rosq}
+N=1000000
+REP=200
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+TIMEFORMAT=%R
+
+base() {
+    echo "(def {xs} (arange $N))"
+    echo "(def {ys} (aadd xs xs))"
+    echo "(def {fx} (farr xs))"
+    echo "(def {fy} (farr ys))"
+    echo '(def {rep} (\ {n f} {if (== n 0) {0} {if (== (f n) 0) {rep (- n 1) f} {rep (- n 1) f}}}))'
+}
+
+# name, expression run REP times, arrays read per run
+bench() {
+    { base; echo "(rep $REP (\\ {_} {$2}))"; } > "$TMP/$1.lspy"
+    t=$( { time "$ROSQ" "$TMP/$1.lspy" > /dev/null; } 2>&1 )
+    awk -v b="$1" -v t="$t" -v t0="$T0" -v n="$N" -v r="$REP" -v k="$3" \
+        'BEGIN { s = t - t0; printf "%10s %10.3f %12.0f\n", b, s, k * n * 8 * r / s / 1e6 }'
+}
+
+base > "$TMP/base.lspy"
+T0=$( { time "$ROSQ" "$TMP/base.lspy" > /dev/null; } 2>&1 )
+
+printf "%10s %10s %12s\n" kernel seconds MB/s
+bench asum    "asum xs" 1
+bench fsum    "asum fx" 1
+bench amax    "amax xs" 1
+bench fmax    "amax fx" 1
+bench adot    "adot xs ys" 2
+bench fdot    "adot fx fy" 2
+bench aadd    "aadd xs ys" 2
+bench fmul    "amul fx fy" 2
+bench alt     "alt xs ys" 2
+
+# The same sum over a list, once only as it is far slower
+{ echo "(def {l} (alist (arange $N)))"; } > "$TMP/lbase.lspy"
+{ cat "$TMP/lbase.lspy"; echo "(foldl + 0 l)"; } > "$TMP/list.lspy"
+l0=$( { time "$ROSQ" "$TMP/lbase.lspy" > /dev/null; } 2>&1 )
+t=$( { time "$ROSQ" "$TMP/list.lspy" > /dev/null; } 2>&1 )
+awk -v t="$t" -v t0="$l0" -v n="$N" \
+    'BEGIN { s = t - t0; printf "%10s %10.3f %12.0f  (1 run)\n", "foldl +", s, n * 8 / s / 1e6 }'
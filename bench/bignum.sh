@@ -0,0 +1,38 @@
+#!/usr/bin/env bash
+#
+# Big Number arithmetic: factorial(10000), which has 35660 digits, and the
+# square of it, which is large enough on both sides to multiply by
+# Karatsuba. Also times a fixnum loop, which should cost the same as it did
+# before Big Numbers, since the long path only adds an overflow check.
+#
+#   usage: bench/bignum.sh [path/to/rosq]
+
+ROSQ=${1:-./rosq}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+TIMEFORMAT=%R
+
+cat > "$TMP/fact.lspy" <<'LSPY'
+(def {fact} (\ {n acc} {if (== n 0) {acc} {fact (- n 1) (* acc n)}}))
+(print (fact 10000 1))
+LSPY
+
+cat > "$TMP/square.lspy" <<'LSPY'
+(def {fact} (\ {n acc} {if (== n 0) {acc} {fact (- n 1) (* acc n)}}))
+(def {f} (fact 10000 1))
+(def {rep} (\ {n} {if (== n 0) {0} {if (== (* f f) 0) {1} {rep (- n 1)}}}))
+(print (rep 20))
+LSPY
+
+cat > "$TMP/fixnum.lspy" <<'LSPY'
+(def {sum} (\ {n acc} {if (== n 0) {acc} {sum (- n 1) (+ acc n)}}))
+(print (sum 5000000 0))
+LSPY
+
+printf "%10s %10s  %s\n" bench seconds result
+for B in fact square fixnum; do
+    t=$( { time "$ROSQ" "$TMP/$B.lspy" > "$TMP/$B.out"; } 2>&1 )
+    result=$(tr -d ' \n' < "$TMP/$B.out")
+    [ ${#result} -gt 20 ] && result="${#result} digits"
+    printf "%10s %10s  %s\n" "$B" "$t" "$result"
+done
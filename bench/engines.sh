@@ -0,0 +1,43 @@
+#!/usr/bin/env bash
+#
+# Bytecode VM against the reference tree-walker (--tree-walk).
+#
+# Runs fib, map and foldl written the way the prelude writes them, once
+# with each engine, and checks that both print the same thing.
+#
+#   usage: bench/engines.sh [path/to/rosq]
+
+ROSQ=${1:-./rosq}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+TIMEFORMAT=%R
+
+cat > "$TMP/fib.lspy" <<'LSPY'
+(def {fib} (\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}))
+(print (fib 24))
+LSPY
+
+cat > "$TMP/map.lspy" <<'LSPY'
+(def {iota} (\ {n} {if (== n 0) {{}} {join (iota (- n 1)) (list n)}}))
+(def {map} (\ {f l} {if (== l {}) {{}} {join (list (f (eval (head l)))) (map f (tail l))}}))
+(def {xs} (iota 500))
+(def {rep} (\ {n} {if (== n 0) {0} {+ (len (map (\ {x} {* x 2}) xs)) (rep (- n 1))}}))
+(print (rep 40))
+LSPY
+
+cat > "$TMP/foldl.lspy" <<'LSPY'
+(def {iota} (\ {n} {if (== n 0) {{}} {join (iota (- n 1)) (list n)}}))
+(def {foldl} (\ {f z l} {if (== l {}) {z} {foldl f (f z (eval (head l))) (tail l)}}))
+(def {xs} (iota 500))
+(def {rep} (\ {n} {if (== n 0) {0} {+ (foldl + 0 xs) (rep (- n 1))}}))
+(print (rep 40))
+LSPY
+
+printf "%8s %10s %10s %8s\n" bench vm tree speedup
+for B in fib map foldl; do
+    vm=$( { time "$ROSQ" "$TMP/$B.lspy" > "$TMP/$B.vm"; } 2>&1 )
+    tree=$( { time "$ROSQ" --tree-walk "$TMP/$B.lspy" > "$TMP/$B.tree"; } 2>&1 )
+    cmp -s "$TMP/$B.vm" "$TMP/$B.tree" || echo "$B: engines disagree"
+    awk -v b="$B" -v v="$vm" -v t="$tree" \
+        'BEGIN { printf "%8s %10.3f %10.3f %7.1fx\n", b, v, t, t / v }'
+done
@@ -0,0 +1,33 @@
+#!/usr/bin/env bash
+#
+# Global lookup cost as the number of globals grows.
+#
+# For each size N this defines N globals, then a function 'spin' that is
+# defined last, and calls it enough times to do ~1M global lookups. The
+# time for the definitions alone is subtracted, so what is left should
+# stay flat with N now the global environment is hash indexed.
+#
+#   usage: bench/env_lookup.sh [path/to/rosq]
+
+ROSQ=${1:-./rosq}
+SPIN=65536
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+TIMEFORMAT=%R
+
+# About 2 calls per unit of n, each looking up 8 globals
+SPIN_DEF='(def {spin} (\ {n} {if (< n 2) {n} {+ (spin (/ n 2)) (spin (- n (/ n 2)))}}))'
+
+printf "%8s %10s %10s %12s\n" globals defs total "ns/lookup"
+for N in 10 100 1000 2000 4000 8000; do
+    awk -v n="$N" 'BEGIN { for (i = 0; i < n; i++) printf "(def {g%d} %d)\n", i, i }' > "$TMP/defs.lspy"
+    echo "$SPIN_DEF" >> "$TMP/defs.lspy"
+    cp "$TMP/defs.lspy" "$TMP/run.lspy"
+    echo "(spin $SPIN)" >> "$TMP/run.lspy"
+
+    defs=$( { time "$ROSQ" "$TMP/defs.lspy" > /dev/null; } 2>&1 )
+    total=$( { time "$ROSQ" "$TMP/run.lspy" > /dev/null; } 2>&1 )
+
+    awk -v n="$N" -v d="$defs" -v t="$total" -v s="$SPIN" \
+        'BEGIN { printf "%8d %10.3f %10.3f %12.1f\n", n, d, t, (t - d) * 1e9 / (s * 2 * 8) }'
+done
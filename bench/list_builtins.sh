@@ -0,0 +1,68 @@
+#!/usr/bin/env bash
+#
+# Native list builtins against the Rosq definitions they replaced in the
+# prelude, on lists of 10^3 to 10^6 elements.
+#
+# The Rosq versions of reverse and map rebuild their result with join at
+# every step, so they are quadratic, and the Rosq versions only run up to
+# ROSQ_MAX elements. Times are for one call, less the time to build the list.
+#
+#   usage: bench/list_builtins.sh [path/to/rosq]
+
+ROSQ=${1:-./rosq}
+ROSQ_MAX=10000
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+TIMEFORMAT=%R
+
+# The old prelude definitions, renamed
+cat > "$TMP/old.lspy" <<'LSPY'
+(def {fst} (\ {l} { eval (head l) }))
+(def {old-len} (\ {l} {if (== l {}) {0} {+ 1 (old-len (tail l))}}))
+(def {old-nth} (\ {n l} {if (== n 0) {fst l} {old-nth (- n 1) (tail l)}}))
+(def {old-last} (\ {l} {old-nth (- (old-len l) 1) l}))
+(def {old-reverse} (\ {l} {if (== l {}) {{}} {join (old-reverse (tail l)) (head l)}}))
+(def {old-foldl} (\ {f z l} {if (== l {}) {z} {old-foldl f (f z (fst l)) (tail l)}}))
+(def {old-map} (\ {f l} {if (== l {}) {{}} {join (list (f (fst l))) (old-map f (tail l))}}))
+LSPY
+
+# Double a list up to 1280 * 2^10 elements, then cut it down to n
+build() {
+    cat "$TMP/old.lspy"
+    echo '(def {grow} (\ {l k} {if (== k 0) {l} {grow (join l l) (- k 1)}}))'
+    echo "(def {xs} (take $1 (grow {1 2 3 4 5 6 7 8 9 10} 17)))"
+}
+
+declare -A CALL=(
+    [len]='(len xs)'
+    [last]='(last xs)'
+    [reverse]='(len (reverse xs))'
+    [foldl]='(foldl + 0 xs)'
+    [map]='(len (map (\ {x} {* x 2}) xs))'
+)
+
+run() {
+    { time "$ROSQ" "$1" > /dev/null; } 2>&1
+}
+
+printf "%8s %8s %10s %10s\n" fn n native rosq
+for N in 1000 10000 100000 1000000; do
+    build $N > "$TMP/base.lspy"
+    base=$(run "$TMP/base.lspy")
+    for F in len last reverse foldl map; do
+        cp "$TMP/base.lspy" "$TMP/native.lspy"
+        echo "${CALL[$F]}" >> "$TMP/native.lspy"
+        native=$(run "$TMP/native.lspy")
+
+        rosq=-
+        if [ $N -le $ROSQ_MAX ]; then
+            cp "$TMP/base.lspy" "$TMP/rosq.lspy"
+            echo "${CALL[$F]}" | sed "s/(\($F\) /(old-\1 /" >> "$TMP/rosq.lspy"
+            rosq=$(run "$TMP/rosq.lspy")
+            rosq=$(awk -v t="$rosq" -v b="$base" 'BEGIN { d = t - b; if (d < 0) d = 0; printf "%.3f", d }')
+        fi
+
+        awk -v f="$F" -v n="$N" -v t="$native" -v b="$base" -v r="$rosq" \
+            'BEGIN { d = t - b; if (d < 0) d = 0; printf "%8s %8d %10.3f %10s\n", f, n, d, r }'
+    done
+done
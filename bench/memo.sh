@@ -0,0 +1,40 @@
+#!/usr/bin/env bash
+#
+# memo: naive fib against memoised fib, where the recursion goes back
+# through the memoised global so each n is only computed once. Also cycles
+# 13 keys through caches that fit them (all hits after the first round) and
+# that do not (every call misses and evicts), to show what a hit and a
+# thrashing LRU cost.
+#
+#   usage: bench/memo.sh [path/to/rosq]
+
+ROSQ=${1:-./rosq}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+TIMEFORMAT=%R
+
+cat > "$TMP/naive.lspy" <<'LSPY'
+(def {fib} (\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}))
+(print (fib 25))
+LSPY
+
+cat > "$TMP/memo.lspy" <<'LSPY'
+(def {fib} (\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}))
+(def {fib} (memo fib))
+(print (fib 25))
+LSPY
+
+for CAP in 20 7; do
+cat > "$TMP/cap$CAP.lspy" <<LSPY
+(def {f} (memo (\\ {x} {list x (join {a b} (list x))}) $CAP))
+(def {loop} (\\ {n acc} {if (== n 0) {acc} {loop (- n 1) (+ acc (len (f (- n (* 13 (/ n 13)))))) }}))
+(print (loop 200000 0))
+(print (memo-stats f))
+LSPY
+done
+
+printf "%8s %10s  %s\n" bench seconds result
+for B in naive memo cap20 cap7; do
+    t=$( { time "$ROSQ" "$TMP/$B.lspy" > "$TMP/$B.out"; } 2>&1 )
+    printf "%8s %10s  %s\n" "$B" "$t" "$(tr '\n' ' ' < "$TMP/$B.out")"
+done
@@ -0,0 +1,32 @@
+#!/usr/bin/env bash
+#
+# Throughput of the mpc parser (--mpc-reader) loading data files of 10^3 to
+# 10^5 records, about 77 bytes each. Files are mapped into memory and
+# parsed as one buffer of known length, so MB/s should stay flat as the
+# file grows.
+#
+#   usage: bench/mpc_input.sh [path/to/rosq]
+
+ROSQ=${1:-./rosq}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+TIMEFORMAT=%R
+
+printf "%8s %10s %10s %8s\n" records bytes seconds MB/s
+for N in 1000 10000 100000; do
+    awk -v n="$N" 'BEGIN {
+        print "(def {data} {"
+        for (i = 0; i < n; i++) {
+            printf "  {%d \"record %d\" item-%d {%d.5 -%d {x y z}} 1e%d} ; row %d\n",
+                i, i, i % 1000, i, i * 7, i % 300, i
+        }
+        print "})"
+        print "(print (len data))"
+    }' > "$TMP/data.lspy"
+
+    bytes=$(wc -c < "$TMP/data.lspy")
+    t=$( { time "$ROSQ" --mpc-reader "$TMP/data.lspy" > "$TMP/out"; } 2>&1 )
+    [ "$(tr -d ' \n' < "$TMP/out")" = "$N" ] || echo "$N: wrong result"
+    awk -v n="$N" -v b="$bytes" -v t="$t" \
+        'BEGIN { printf "%8d %10d %10.3f %8.2f\n", n, b, t, b / 1e6 / t }'
+done
@@ -0,0 +1,86 @@
+#!/usr/bin/env bash
+#
+# mpc with and without packrat memoisation on a grammar whose alternatives
+# share a prefix, so every failed alternative re-parses <term> or <factor>
+# from the same position. Without the memo table that re-parsing compounds
+# with each level of nesting and time grows exponentially with depth; with
+# MPCA_LANG_PACKRAT each rule runs once per position and time stays linear.
+# Plain runs stop at depth 5, past which they take minutes.
+#
+#   usage: bench/mpc_packrat.sh [cc]
+
+CC=${1:-cc}
+DIR=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+cat > "$TMP/packrat.c" <<'EOF'
+#include <time.h>
+#include "mpc.h"
+
+static double run(int flags, const char *src, mpc_packrat_stats_t *st) {
+
+  mpc_parser_t *Expr   = mpc_new("expr");
+  mpc_parser_t *Term   = mpc_new("term");
+  mpc_parser_t *Factor = mpc_new("factor");
+  mpc_result_t r;
+  clock_t t;
+
+  mpca_lang(flags,
+    " expr   : <term> '+' <expr> | <term> '-' <expr> | <term> ;    "
+    " term   : <factor> '*' <term> | <factor> '/' <term> | <factor> ; "
+    " factor : '(' <expr> ')' | /[0-9]+/ ;                           ",
+    Expr, Term, Factor, NULL);
+
+  mpc_packrat_stats_reset();
+  t = clock();
+  if (mpc_parse("<bench>", src, Expr, &r)) {
+    mpc_ast_delete(r.output);
+  } else {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+  }
+  t = clock() - t;
+  mpc_packrat_stats(st);
+
+  mpc_cleanup(3, Expr, Term, Factor);
+  return (double)t / CLOCKS_PER_SEC;
+}
+
+int main(void) {
+
+  int depths[] = { 1, 2, 3, 4, 5, 50, 500, 2000 };
+  int d, depth, j;
+  char *src, *s;
+  double packrat;
+  mpc_packrat_stats_t st;
+
+  printf("%6s %10s %10s %8s\n", "depth", "plain", "packrat", "hits");
+  for (d = 0; d < 8; d++) {
+    depth = depths[d];
+    src = s = malloc(depth * 4 + 2);
+    for (j = 0; j < depth; j++) { memcpy(s, "1+(", 3); s += 3; }
+    *s++ = '1';
+    for (j = 0; j < depth; j++) { *s++ = ')'; }
+    *s = '\0';
+
+    /* The plain parser is only run while it finishes in seconds */
+    printf("%6d ", depth);
+    if (depth <= 5) {
+      printf("%10.4f ", run(MPCA_LANG_DEFAULT, src, &st));
+    } else {
+      printf("%10s ", "-");
+    }
+    packrat = run(MPCA_LANG_PACKRAT, src, &st);
+    printf("%10.4f %7.1f%%\n", packrat,
+      st.lookups ? 100.0 * st.hits / st.lookups : 0.0);
+    fflush(stdout);
+    free(src);
+  }
+
+  return 0;
+}
+EOF
+
+"$CC" -std=c99 -O2 -I"$DIR" "$TMP/packrat.c" "$DIR/mpc.c" -lm -o "$TMP/packrat" &&
+"$TMP/packrat"
@@ -0,0 +1,132 @@
+#!/usr/bin/env bash
+#
+# Differential check of mpc's packrat mode against plain mpc. Two parts:
+#
+#  - rosq --mpc-packrat against rosq --mpc-reader on random token soups,
+#    which must print exactly the same values and error messages.
+#  - A small driver on a grammar whose alternatives share a prefix, so
+#    results really are replayed, lent out and taken back. Random inputs
+#    are parsed both ways and the printed ASTs or errors must match. The
+#    second half of the inputs runs with an 8 slot table so that entries
+#    are evicted constantly.
+#
+# The driver is built with sanitizers, and rosq should be too:
+#
+#   cc -std=c99 -g -fsanitize=address,undefined strings.c mpc.c -ledit -lm -o rosq_san
+#
+#   usage: bench/mpc_packrat_diff.sh [path/to/rosq] [cases] [seed]
+
+ROSQ=${1:-./rosq}
+CASES=${2:-400}
+SEED=${3:-1}
+CC=${CC:-cc}
+DIR=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+export UBSAN_OPTIONS=print_stacktrace=1:halt_on_error=1
+
+awk -v n="$CASES" -v seed="$SEED" -v dir="$TMP" 'BEGIN {
+    srand(seed)
+    np = split("( ) { } ( ) -2 1 3.5e2 x + ab - 1e . <= 99999999999999999999 % &", p, " ")
+    p[++np] = "\"s\\\"t\""
+    p[++np] = "\"unterminated"
+    p[++np] = ";c\n"
+    p[++np] = " "
+    p[++np] = "\n"
+    for (k = 1; k <= n; k++) {
+        soup = ""
+        m = 1 + int(rand() * 40)
+        for (j = 0; j < m; j++) { soup = soup p[1 + int(rand() * np)] }
+        printf "%s\n", soup > (dir "/" k ".lspy")
+        close(dir "/" k ".lspy")
+    }
+}'
+
+bad=0
+for k in $(seq 1 "$CASES"); do
+    f="$TMP/$k.lspy"
+    "$ROSQ" --mpc-reader "$f" > "$TMP/plain.out" 2> "$TMP/plain.err"
+    "$ROSQ" --mpc-packrat "$f" > "$TMP/packrat.out" 2> "$TMP/packrat.err"
+    if grep -q "runtime error\|Sanitizer" "$TMP/plain.err" "$TMP/packrat.err" \
+    || ! cmp -s "$TMP/plain.out" "$TMP/packrat.out"; then
+        bad=$((bad + 1))
+        if [ "$bad" -le 5 ]; then
+            echo "rosq case $k:"
+            sed 's/^/  | /' "$f"
+            sed 's/^/  plain:   /' "$TMP/plain.out" "$TMP/plain.err"
+            sed 's/^/  packrat: /' "$TMP/packrat.out" "$TMP/packrat.err"
+        fi
+    fi
+done
+echo "rosq: $CASES cases, $bad disagreements"
+
+cat > "$TMP/diff.c" <<'EOF'
+#include "mpc.h"
+
+static char *parse(int flags, const char *src) {
+
+  mpc_parser_t *Expr   = mpc_new("expr");
+  mpc_parser_t *Term   = mpc_new("term");
+  mpc_parser_t *Factor = mpc_new("factor");
+  mpc_result_t r;
+  mpc_err_t *err;
+  FILE *f = tmpfile();
+  char *out;
+  long n;
+
+  err = mpca_lang(flags,
+    " expr   : <term> '+' <expr> | <term> '-' <expr> | <term> ;    "
+    " term   : <factor> '*' <term> | <factor> '/' <term> | <factor> ; "
+    " factor : '(' <expr> ')' | /[0-9]+/ | 'y' 'x'? 'y'? ;           ",
+    Expr, Term, Factor, NULL);
+  if (err) { mpc_err_print(err); exit(2); }
+
+  if (mpc_parse("<diff>", src, Expr, &r)) {
+    mpc_ast_print_to(r.output, f);
+    mpc_ast_delete(r.output);
+  } else {
+    mpc_err_print_to(r.error, f);
+    mpc_err_delete(r.error);
+  }
+
+  n = ftell(f);
+  rewind(f);
+  out = calloc(n + 1, 1);
+  if (fread(out, 1, n, f) != (size_t)n) { exit(2); }
+  fclose(f);
+
+  mpc_cleanup(3, Expr, Term, Factor);
+  return out;
+}
+
+int main(int argc, char **argv) {
+
+  const char *alphabet = "1234()+-*/yx";
+  int cases = atoi(argv[1]), n, k, len, bad = 0;
+  char src[16], *plain, *packrat;
+
+  srand(atoi(argv[2]));
+  for (n = 0; n < cases; n++) {
+    if (n == cases / 2) { mpc_packrat_limit(8); }
+    len = 1 + rand() % 12;
+    for (k = 0; k < len; k++) { src[k] = alphabet[rand() % 12]; }
+    src[len] = '\0';
+
+    plain = parse(MPCA_LANG_DEFAULT, src);
+    packrat = parse(MPCA_LANG_PACKRAT, src);
+    if (strcmp(plain, packrat) != 0 && bad++ < 5) {
+      printf("input %s\n  plain:\n%s  packrat:\n%s", src, plain, packrat);
+    }
+    free(plain);
+    free(packrat);
+  }
+
+  printf("grammar: %d cases, %d disagreements\n", cases, bad);
+  (void) argc;
+  return bad != 0;
+}
+EOF
+
+"$CC" -std=c99 -g -O1 -fsanitize=address,undefined -I"$DIR" \
+    "$TMP/diff.c" "$DIR/mpc.c" -lm -o "$TMP/diff" || exit 1
+"$TMP/diff" "$CASES" "$SEED" && [ "$bad" = 0 ]
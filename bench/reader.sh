@@ -0,0 +1,46 @@
+#!/usr/bin/env bash
+#
+# Loading large data files with the reader against the mpc grammar it
+# replaced (--mpc-reader). 'nested' is 100000 records of numbers, strings,
+# symbols and nested lists inside one form, about 6MB; 'toplevel' is 200000
+# top-level forms, which load has to get through one by one. Both readers
+# must read the same thing.
+#
+#   usage: bench/reader.sh [path/to/rosq]
+
+ROSQ=${1:-./rosq}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+TIMEFORMAT=%R
+
+awk 'BEGIN {
+    print "; generated by bench/reader.sh"
+    print "(def {data} {"
+    for (i = 0; i < 100000; i++) {
+        printf "  {%d \"record %d\" item-%d {%d.5 -%d {x y z}} 1e%d} ; row %d\n",
+            i, i, i % 1000, i, i * 7, i % 300, i
+    }
+    print "})"
+    print "(print (len data) (last data))"
+}' > "$TMP/nested.lspy"
+
+awk 'BEGIN {
+    print "; generated by bench/reader.sh"
+    for (i = 0; i < 100000; i++) {
+        printf "%d {%d \"record %d\" item-%d}\n", i, i, i, i % 1000
+    }
+    print "(print \"forms\" 200000)"
+}' > "$TMP/toplevel.lspy"
+
+printf "%8s %8s %10s %8s  %s\n" file reader seconds MB/s result
+for F in nested toplevel; do
+    for R in reader mpc; do
+        flag=""
+        [ "$R" = mpc ] && flag=--mpc-reader
+        t=$( { time "$ROSQ" $flag "$TMP/$F.lspy" > "$TMP/$F.$R.out"; } 2>&1 )
+        awk -v f="$F" -v r="$R" -v t="$t" -v n="$(wc -c < "$TMP/$F.lspy")" \
+            -v out="$(tr -d '\n' < "$TMP/$F.$R.out")" \
+            'BEGIN { printf "%8s %8s %10.3f %8.1f  %s\n", f, r, t, n / 1e6 / t, out }'
+    done
+    cmp -s "$TMP/$F.reader.out" "$TMP/$F.mpc.out" || echo "$F: readers disagree"
+done
@@ -0,0 +1,81 @@
+#!/usr/bin/env bash
+#
+# Differential check of the reader against the mpc grammar (--mpc-reader).
+# Random soups of number, string, symbol, comment and bracket tokens are
+# quoted into a file and loaded both ways. Both must accept or reject the
+# same files, and print the same values when they accept. Build rosq with
+# sanitizers so that undefined behaviour fails the check too:
+#
+#   cc -std=c99 -g -fsanitize=address,undefined strings.c mpc.c -ledit -lm -o rosq_san
+#
+#   usage: bench/reader_diff.sh [path/to/rosq] [cases] [seed]
+
+ROSQ=${1:-./rosq}
+CASES=${2:-400}
+SEED=${3:-1}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+export UBSAN_OPTIONS=print_stacktrace=1:halt_on_error=1
+
+awk -v n="$CASES" -v seed="$SEED" -v dir="$TMP" 'BEGIN {
+    srand(seed)
+    np = split("( ) { } - 1 12ab 1.5 1. .5 1e5 1e 1E+3 2e-2x -x 0x1A -5 a-5 + <= " \
+               "\\ 1.5.3 007 -0 1.0e400 abc {} () & | % 1-2 " \
+               "99999999999999999999 12345678901234567890 123456789012345678 " \
+               "1234567890123456789 -9223372036854775808 9223372036854775807 " \
+               "-123456789012345678901234567890.5", p, " ")
+    p[++np] = "\"a\\\"b\""
+    p[++np] = "\"\\n\\t\""
+    p[++np] = "\"multi\nline\""
+    p[++np] = "\"long string that goes beyond the inline limit\""
+    p[++np] = "\"\\q\""
+    p[++np] = "\""
+    p[++np] = ";c\n"
+    p[++np] = " "
+    p[++np] = "\n"
+    p[++np] = "\t"
+    p[++np] = "\r\n"
+    for (k = 1; k <= n; k++) {
+        soup = ""
+        m = int(rand() * 13)
+        for (j = 0; j < m; j++) {
+            soup = soup p[1 + int(rand() * np)]
+            if (rand() < 0.33) { soup = soup " " }
+        }
+        printf "(print {%s})\n", soup > (dir "/" k ".lspy")
+        close(dir "/" k ".lspy")
+    }
+}'
+
+bad=0
+for k in $(seq 1 "$CASES"); do
+    f="$TMP/$k.lspy"
+    "$ROSQ" "$f" > "$TMP/reader.out" 2> "$TMP/reader.err"
+    "$ROSQ" --mpc-reader "$f" > "$TMP/mpc.out" 2> "$TMP/mpc.err"
+
+    why=""
+    if grep -q "runtime error\|Sanitizer" "$TMP/reader.err" "$TMP/mpc.err"; then
+        why="sanitizer report"
+    else
+        ra=$(grep -c "Could not load" "$TMP/reader.out")
+        ma=$(grep -c "Could not load" "$TMP/mpc.out")
+        if [ "$ra" != "$ma" ]; then
+            why="only one reader rejects it"
+        elif [ "$ra" = 0 ] && ! cmp -s "$TMP/reader.out" "$TMP/mpc.out"; then
+            why="different values"
+        fi
+    fi
+
+    if [ -n "$why" ]; then
+        bad=$((bad + 1))
+        if [ "$bad" -le 5 ]; then
+            echo "case $k: $why"
+            sed 's/^/  | /' "$f"
+            sed 's/^/  reader: /' "$TMP/reader.out" "$TMP/reader.err"
+            sed 's/^/  mpc:    /' "$TMP/mpc.out" "$TMP/mpc.err"
+        fi
+    fi
+done
+
+echo "$CASES cases, $bad disagreements"
+[ "$bad" = 0 ]
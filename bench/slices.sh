@@ -0,0 +1,40 @@
+#!/usr/bin/env bash
+#
+# Prelude-style recursion over lists of 10^3 to 10^6 elements, walking them
+# with tail, init and drop. With head, tail and init returning views these
+# are linear, so the time per element should stay flat as the lists grow.
+#
+#   usage: bench/slices.sh [path/to/rosq]
+
+ROSQ=${1:-./rosq}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+TIMEFORMAT=%R
+
+# Double a list up to 1280 * 2^10 elements, then cut it down to n
+build() {
+    echo '(def {grow} (\ {l k} {if (== k 0) {l} {grow (join l l) (- k 1)}}))'
+    echo "(def {xs} (take $1 (grow {1 2 3 4 5 6 7 8 9 10} 17)))"
+    echo '(def {tails} (\ {l n} {if (== l {}) {n} {tails (tail l) (+ n 1)}}))'
+    echo '(def {inits} (\ {l n} {if (== l {}) {n} {inits (init l) (+ n 1)}}))'
+    echo '(def {sum} (\ {l s} {if (== l {}) {s} {sum (tail l) (+ s (eval (head l)))}}))'
+    echo '(def {chunks} (\ {l n} {if (== l {}) {n} {chunks (drop 1 l) (+ n 1)}}))'
+}
+
+run() {
+    { time "$ROSQ" "$1" > /dev/null; } 2>&1
+}
+
+printf "%8s %8s %10s %12s\n" fn n seconds ns/element
+for N in 1000 10000 100000 1000000; do
+    build $N > "$TMP/base.lspy"
+    base=$(run "$TMP/base.lspy")
+    for F in tails inits sum chunks; do
+        cp "$TMP/base.lspy" "$TMP/run.lspy"
+        echo "($F xs 0)" >> "$TMP/run.lspy"
+        t=$(run "$TMP/run.lspy")
+        awk -v f="$F" -v n="$N" -v t="$t" -v b="$base" \
+            'BEGIN { d = t - b; if (d < 0) d = 0;
+                     printf "%8s %8d %10.3f %12.0f\n", f, n, d, d * 1e9 / n }'
+    done
+done
@@ -0,0 +1,25 @@
+#!/usr/bin/env bash
+#
+# Builds a report of 1 MB to 100 MB by joining one 100 byte line at a time.
+# Appends go into a shared buffer that doubles as it fills, so the time per
+# line should stay flat as the report grows.
+#
+#   usage: bench/string_join.sh [path/to/rosq]
+
+ROSQ=${1:-./rosq}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+TIMEFORMAT=%R
+
+LINE=$(printf '%099d' 0)
+
+printf "%8s %10s %10s\n" MB seconds ns/line
+for LINES in 10000 100000 1000000; do
+    cat > "$TMP/report.lspy" <<LSPY
+(def {build} (\ {r i} {if (== i $LINES) {r} {build (join r "$LINE\n") (+ i 1)}}))
+(def {report} (build "" 0))
+LSPY
+    t=$({ time "$ROSQ" "$TMP/report.lspy" > /dev/null; } 2>&1)
+    awk -v n="$LINES" -v t="$t" \
+        'BEGIN { printf "%8d %10.3f %10.0f\n", n / 10000, t, t * 1e9 / n }'
+done
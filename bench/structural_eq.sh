@@ -0,0 +1,39 @@
+#!/usr/bin/env bash
+#
+# elem and lookup over 300 keys that only differ in their last element, so
+# every comparison used to walk all 25 elements. Shared lists keep their
+# structural hash, which tells unequal keys apart at once after the first
+# pass.
+#
+#   usage: bench/structural_eq.sh [path/to/rosq]
+
+ROSQ=${1:-./rosq}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+TIMEFORMAT=%R
+
+cat > "$TMP/keys.lspy" <<'LSPY'
+(def {true} 1)
+(def {false} 0)
+(def {mk} (\ {i} {list 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 i}))
+(def {build} (\ {n acc} {if (== n 0) {acc} {build (- n 1) (join acc (list (mk n)))}}))
+(def {keys} (build 300 {}))
+(def {q} (mk 1))
+LSPY
+
+cat "$TMP/keys.lspy" - > "$TMP/elem.lspy" <<'LSPY'
+(def {rep} (\ {n acc} {if (== n 0) {acc} {rep (- n 1) (+ acc (elem q keys))}}))
+(print (rep 2000 0))
+LSPY
+
+cat "$TMP/keys.lspy" - > "$TMP/lookup.lspy" <<'LSPY'
+(def {pairs} (map (\ {k} {list k (len k)}) keys))
+(def {rep} (\ {n acc} {if (== n 0) {acc} {rep (- n 1) (+ acc (lookup q pairs))}}))
+(print (rep 2000 0))
+LSPY
+
+printf "%8s %10s  %s\n" bench seconds result
+for B in elem lookup; do
+    t=$( { time "$ROSQ" "$TMP/$B.lspy" > "$TMP/$B.out"; } 2>&1 )
+    printf "%8s %10s  %s\n" "$B" "$t" "$(tr -d '\n' < "$TMP/$B.out")"
+done
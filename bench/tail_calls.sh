@@ -0,0 +1,42 @@
+#!/usr/bin/env bash
+#
+# Tail call stress test: 10M-iteration loops that only finish in constant
+# C stack space, with the time each one takes.
+#
+#   usage: bench/tail_calls.sh [path/to/rosq]
+
+ROSQ=${1:-./rosq}
+N=10000000
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+TIMEFORMAT=%R
+
+cat > "$TMP/count.lspy" <<LSPY
+(def {count} (\\ {n} {if (== n 0) {0} {count (- n 1)}}))
+(print (count $N))
+LSPY
+
+cat > "$TMP/sum.lspy" <<LSPY
+(def {sum} (\\ {n acc} {if (== n 0) {acc} {sum (- n 1) (+ acc n)}}))
+(print (sum $N 0))
+LSPY
+
+cat > "$TMP/even_odd.lspy" <<LSPY
+(def {even} (\\ {n} {if (== n 0) {(== 0 0)} {odd (- n 1)}}))
+(def {odd} (\\ {n} {if (== n 0) {(== 0 1)} {even (- n 1)}}))
+(print (even $N))
+LSPY
+
+# Deep enough recursion to exhaust the C stack if tail calls were not
+# eliminated, so a crash here is a failure
+ulimit -s 8192
+
+printf "%10s %10s %12s  %s\n" loop seconds "ns/iter" result
+for B in count sum even_odd; do
+    t=$( { time "$ROSQ" "$TMP/$B.lspy" > "$TMP/$B.out"; } 2>&1 )
+    status=$?
+    result=$(tr -d ' \n' < "$TMP/$B.out")
+    [ $status -eq 0 ] || result="FAILED ($status)"
+    awk -v b="$B" -v t="$t" -v n="$N" -v r="$result" \
+        'BEGIN { printf "%10s %10.3f %12.1f  %s\n", b, t, t * 1e9 / n, r }'
+done
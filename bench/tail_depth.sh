@@ -0,0 +1,52 @@
+#!/usr/bin/env bash
+#
+# Tail calls 10^6 deep under an 8 MB stack, in both the bytecode VM and the
+# tree-walker (--tree-walk), checking the printed results. Besides self and
+# mutual recursion it covers callees that leave caller bindings visible,
+# reached through dynamic scope, which still have to run in constant stack.
+#
+#   usage: bench/tail_depth.sh [path/to/rosq]
+
+ROSQ=${1:-./rosq}
+N=1000000
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+cat > "$TMP/depth.lspy" <<LSPY
+(def {count} (\\ {n} {if (== n 0) {0} {count (- n 1)}}))
+(print (count $N))
+
+(def {sum} (\\ {n acc} {if (== n 0) {acc} {sum (- n 1) (+ acc n)}}))
+(print (sum $N 0))
+
+(def {ev} (\\ {n} {if (== n 0) {1} {od (- n 1)}}))
+(def {od} (\\ {m} {if (== m 0) {0} {ev (- m 1)}}))
+(print (ev (+ $N 1)))
+
+; loop never binds k, it is the caller's
+(def {loop} (\\ {n} {if (== n 0) {k} {loop (- n 1)}}))
+(def {outer} (\\ {k} {loop $N}))
+(print (outer 7))
+
+; through a second function that binds nothing new
+(def {down} (\\ {n} {if (== n 0) {base} {again (- n 1)}}))
+(def {again} (\\ {n} {down n}))
+(def {start} (\\ {base} {down $N}))
+(print (start 42))
+LSPY
+
+expected="0 500000500000 0 7 42"
+bad=0
+for flag in "" --tree-walk; do
+    name=${flag:-vm}
+    name=${name#--}
+    out=$( (ulimit -s 8192; "$ROSQ" $flag "$TMP/depth.lspy") 2>&1 | tr -s ' \n' ' ' )
+    out=${out% }
+    if [ "$out" = "$expected" ]; then
+        printf "%12s  ok\n" "$name"
+    else
+        printf "%12s  expected '%s', got '%s'\n" "$name" "$expected" "$out"
+        bad=1
+    fi
+done
+[ "$bad" = 0 ]
@@ -1,5 +1,15 @@
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "mpc.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define MPC_USE_MMAP
+#endif
+
 /*
 ** State Type
 */
@@ -25,20 +35,19 @@ static mpc_state_t mpc_state_new(void) {
 */
 
 /*
-** In mpc the input type has three modes of 
-** operation: String, File and Pipe.
-**
-** String is easy. The whole contents are 
-** loaded into a buffer and scanned through.
-** The cursor can jump around at will making 
-** backtracking easy.
+** In mpc the input type has two modes of 
+** operation: String and Pipe.
 **
-** The second is a File which is also somewhat
-** easy. The contents are never loaded into 
-** memory but backtracking can still be achieved
-** by seeking in the file at different positions.
+** String is easy. The input is a buffer of
+** known length which is scanned through. The
+** cursor can jump around at will making 
+** backtracking easy. Strings given to `mpc_parse`
+** are borrowed rather than copied, and Files
+** are mapped into memory where the platform
+** allows it, or otherwise read in one go, and
+** then parsed as a String.
 **
-** The final mode is Pipe. This is the difficult
+** The other mode is Pipe. This is the difficult
 ** one. As we assume pipes cannot be seeked - and 
 ** only support a single character lookahead at 
 ** any point, when the input is marked for a 
@@ -57,7 +66,6 @@ static mpc_state_t mpc_state_new(void) {
 
 enum {
   MPC_INPUT_STRING = 0,
-  MPC_INPUT_FILE   = 1,
   MPC_INPUT_PIPE   = 2
 };
 
@@ -73,13 +81,55 @@ typedef struct {
   char mem[64];
 } mpc_mem_t;
 
+/*
+** Packrat Memo Table
+**
+** Parsers wrapped with `mpc_packrat` record
+** their result at each input position so that
+** when backtracking re-runs them at the same
+** place the answer is replayed rather than
+** recomputed. The table is direct-mapped on
+** (parser, position) with a fixed number of
+** slots so memory stays bounded - a collision
+** simply evicts the older entry.
+**
+** Outputs are never copied. A successful
+** result is lent to the caller, and if the
+** caller fails and would destroy it untouched
+** the entry takes it back instead, ready for
+** the next alternative which asks for it.
+*/
+
+typedef struct {
+  void *key;
+  long pos;
+  int suppress;
+  int success;
+  mpc_state_t state;
+  char last;
+  mpc_val_t *output;
+  mpc_val_t *lent;
+  mpc_err_t *error;
+  mpc_err_t *merged;
+  mpc_dtor_t dx;
+} mpc_packrat_entry_t;
+
+typedef struct {
+  mpc_val_t *x;
+  int slot;
+} mpc_packrat_lent_t;
+
 typedef struct {
 
   int type;
   char *filename;  
   mpc_state_t state;
   
-  char *string;
+  const char *string;
+  long length;
+  char *owned;
+  void *mapped;
+  size_t mapped_length;
   char *buffer;
   FILE *file;
   
@@ -92,24 +142,31 @@ typedef struct {
   char *lasts;
   char last;
   
+  int packrat_slots;
+  mpc_packrat_entry_t *packrat;
+  mpc_packrat_lent_t *packrat_lent;
+  
   size_t mem_index;
   char mem_full[MPC_INPUT_MEM_NUM];
   mpc_mem_t mem[MPC_INPUT_MEM_NUM];
   
 } mpc_input_t;
 
-static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
+static mpc_input_t *mpc_input_new(const char *filename, int type) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
   
   i->filename = malloc(strlen(filename) + 1);
   strcpy(i->filename, filename);
-  i->type = MPC_INPUT_STRING;
+  i->type = type;
   
   i->state = mpc_state_new();
   
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
+  i->string = NULL;
+  i->length = 0;
+  i->owned = NULL;
+  i->mapped = NULL;
+  i->mapped_length = 0;
   i->buffer = NULL;
   i->file = NULL;
   
@@ -121,75 +178,88 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
+  i->packrat_slots = 0;
+  i->packrat = NULL;
+  i->packrat_lent = NULL;
+  
   i->mem_index = 0;
   memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
   
   return i;
 }
 
-static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
+/* The buffer is borrowed and must outlive the input */
+static mpc_input_t *mpc_input_new_buffer(const char *filename, const char *string, size_t length) {
+  mpc_input_t *i = mpc_input_new(filename, MPC_INPUT_STRING);
+  i->string = string;
+  i->length = (long)length;
+  return i;
+}
 
-  mpc_input_t *i = malloc(sizeof(mpc_input_t));
-  
-  i->filename = malloc(strlen(filename) + 1);
-  strcpy(i->filename, filename);
-  
-  i->type = MPC_INPUT_PIPE;
-  i->state = mpc_state_new();
-  
-  i->string = NULL;
-  i->buffer = NULL;
+static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
+  return mpc_input_new_buffer(filename, string, strlen(string));
+}
+
+static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
+  mpc_input_t *i = mpc_input_new(filename, MPC_INPUT_PIPE);
   i->file = pipe;
-  
-  i->suppress = 0;
-  i->backtrack = 1;
-  i->marks_num = 0;
-  i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
-  i->last = '\0';
-  
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
-  
   return i;
-  
 }
 
+/* The rest of the file from its current position */
 static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   
-  mpc_input_t *i = malloc(sizeof(mpc_input_t));
-  
-  i->filename = malloc(strlen(filename) + 1);
-  strcpy(i->filename, filename);
-  i->type = MPC_INPUT_FILE;
-  i->state = mpc_state_new();
-  
-  i->string = NULL;
-  i->buffer = NULL;
-  i->file = file;
+  mpc_input_t *i = mpc_input_new(filename, MPC_INPUT_STRING);
+  size_t n = 0, cap = 4096, got;
+  char *buffer;
   
-  i->suppress = 0;
-  i->backtrack = 1;
-  i->marks_num = 0;
-  i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
-  i->last = '\0';
+#ifdef MPC_USE_MMAP
+  {
+    struct stat st;
+    long start = ftell(file);
+    void *m;
+    if (start >= 0 && fstat(fileno(file), &st) == 0
+    &&  S_ISREG(st.st_mode) && st.st_size > start) {
+      m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+      if (m != MAP_FAILED) {
+        i->mapped = m;
+        i->mapped_length = (size_t)st.st_size;
+        i->string = (char*)m + start;
+        i->length = (long)st.st_size - start;
+        fseek(file, 0, SEEK_END);
+        return i;
+      }
+    }
+  }
+#endif
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  /* Otherwise read whatever is left in one go */
+  buffer = malloc(cap);
+  while ((got = fread(buffer + n, 1, cap - n, file)) > 0) {
+    n += got;
+    if (n == cap) { cap *= 2; buffer = realloc(buffer, cap); }
+  }
   
+  i->owned = buffer;
+  i->string = buffer;
+  i->length = (long)n;
   return i;
 }
 
+static void mpc_packrat_delete(mpc_input_t *i);
+
 static void mpc_input_delete(mpc_input_t *i) {
   
+  mpc_packrat_delete(i);
   free(i->filename);
   
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
+  if (i->type == MPC_INPUT_STRING) { free(i->owned); }
   if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
   
+#ifdef MPC_USE_MMAP
+  if (i->mapped) { munmap(i->mapped, i->mapped_length); }
+#endif
+  
   free(i->marks);
   free(i->lasts);
   free(i);
@@ -315,10 +385,6 @@ static void mpc_input_rewind(mpc_input_t *i) {
   i->state = i->marks[i->marks_num-1];
   i->last  = i->lasts[i->marks_num-1];
   
-  if (i->type == MPC_INPUT_FILE) {
-    fseek(i->file, i->state.pos, SEEK_SET);
-  }
-  
   mpc_input_unmark(i);
 }
 
@@ -331,8 +397,7 @@ static char mpc_input_buffer_get(mpc_input_t *i) {
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
-  if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->state.pos >= i->length) { return 1; }
   if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
   return 0;
 }
@@ -343,8 +408,8 @@ static char mpc_input_getc(mpc_input_t *i) {
   
   switch (i->type) {
     
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
-    case MPC_INPUT_FILE: c = fgetc(i->file); return c;
+    case MPC_INPUT_STRING:
+      return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_PIPE:
     
       if (!i->buffer) { c = getc(i->file); return c; }
@@ -366,14 +431,8 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
   
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
-    case MPC_INPUT_FILE: 
-      
-      c = fgetc(i->file);
-      if (feof(i->file)) { return '\0'; }
-      
-      fseek(i->file, -1, SEEK_CUR);
-      return c;
+    case MPC_INPUT_STRING:
+      return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     
     case MPC_INPUT_PIPE:
       
@@ -402,7 +461,6 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
 
   switch (i->type) {
     case MPC_INPUT_STRING: { break; }
-    case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
     case MPC_INPUT_PIPE: {
       
       if (!i->buffer) { ungetc(c, i->file); break; }
@@ -600,7 +658,7 @@ char *mpc_err_string(mpc_err_t *x) {
   }
   
   mpc_err_string_cat(buffer, &pos, &max, " at ");
-  mpc_err_string_cat(buffer, &pos, &max, mpc_err_char_unescape(x->recieved));
+  mpc_err_string_cat(buffer, &pos, &max, "%s", mpc_err_char_unescape(x->recieved));
   mpc_err_string_cat(buffer, &pos, &max, "\n");
   
   return realloc(buffer, strlen(buffer) + 1);
@@ -672,6 +730,37 @@ static mpc_err_t *mpc_err_export(mpc_input_t *i, mpc_err_t *x) {
   return mpc_export(i, x);
 }
 
+static mpc_err_t *mpc_err_copy(mpc_err_t *x) {
+  
+  int j;
+  mpc_err_t *y;
+  
+  if (x == NULL) { return NULL; }
+  
+  y = malloc(sizeof(mpc_err_t));
+  y->state = x->state;
+  y->expected_num = x->expected_num;
+  y->recieved = x->recieved;
+  y->filename = malloc(strlen(x->filename) + 1);
+  strcpy(y->filename, x->filename);
+  y->failure = NULL;
+  if (x->failure) {
+    y->failure = malloc(strlen(x->failure) + 1);
+    strcpy(y->failure, x->failure);
+  }
+  
+  y->expected = NULL;
+  if (x->expected_num) {
+    y->expected = malloc(sizeof(char*) * x->expected_num);
+    for (j = 0; j < x->expected_num; j++) {
+      y->expected[j] = malloc(strlen(x->expected[j]) + 1);
+      strcpy(y->expected[j], x->expected[j]);
+    }
+  }
+  
+  return y;
+}
+
 static int mpc_err_contains_expected(mpc_input_t *i, mpc_err_t *x, char *expected) {
   int j;
   (void)i;
@@ -851,7 +940,9 @@ enum {
   MPC_TYPE_COUNT     = 22,
   
   MPC_TYPE_OR        = 23,
-  MPC_TYPE_AND       = 24
+  MPC_TYPE_AND       = 24,
+  
+  MPC_TYPE_PACKRAT   = 25
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -865,6 +956,7 @@ typedef struct { char *x; } mpc_pdata_string_t;
 typedef struct { mpc_parser_t *x; mpc_apply_t f; } mpc_pdata_apply_t;
 typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_to_t;
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
+typedef struct { mpc_parser_t *x; mpc_dtor_t dx; void *key; } mpc_pdata_packrat_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
 typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
@@ -882,6 +974,7 @@ typedef union {
   mpc_pdata_apply_t apply;
   mpc_pdata_apply_to_t apply_to;
   mpc_pdata_predict_t predict;
+  mpc_pdata_packrat_t packrat;
   mpc_pdata_not_t not;
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
@@ -965,6 +1058,140 @@ static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
   d(mpc_export(i, x));
 }
 
+/*
+** Packrat Memoisation
+*/
+
+static int mpc_packrat_slots_default = 4096;
+static mpc_packrat_stats_t mpc_packrat_counts = { 0, 0, 0, 0, 0 };
+
+void mpc_packrat_limit(int slots) {
+  int n = 1;
+  while (n < slots) { n *= 2; }
+  mpc_packrat_slots_default = n;
+}
+
+void mpc_packrat_stats(mpc_packrat_stats_t *s) {
+  *s = mpc_packrat_counts;
+}
+
+void mpc_packrat_stats_reset(void) {
+  memset(&mpc_packrat_counts, 0, sizeof(mpc_packrat_stats_t));
+}
+
+/* Wrappers built for grammar references share entries through their key */
+static void *mpc_packrat_key(mpc_parser_t *p) {
+  return p->data.packrat.key ? p->data.packrat.key : p;
+}
+
+static void mpc_packrat_clear(mpc_input_t *i, mpc_packrat_entry_t *m) {
+  if (m->output) { mpc_parse_dtor(i, m->dx, m->output); }
+  if (m->error)  { mpc_err_delete(m->error); }
+  if (m->merged) { mpc_err_delete(m->merged); }
+  m->key = NULL;
+  m->output = NULL;
+  m->lent = NULL;
+  m->error = NULL;
+  m->merged = NULL;
+}
+
+static void mpc_packrat_delete(mpc_input_t *i) {
+  int j;
+  if (i->packrat == NULL) { return; }
+  for (j = 0; j < i->packrat_slots; j++) { mpc_packrat_clear(i, &i->packrat[j]); }
+  free(i->packrat);
+  free(i->packrat_lent);
+  i->packrat = NULL;
+  i->packrat_lent = NULL;
+}
+
+static unsigned long mpc_packrat_hash(void *p, long pos) {
+  unsigned long h = (unsigned long)(size_t)p >> 4;
+  h = (h * 2654435761UL) ^ ((unsigned long)pos * 40503UL);
+  return h ^ (h >> 15);
+}
+
+static mpc_packrat_entry_t *mpc_packrat_entry(mpc_input_t *i, void *key) {
+  
+  if (i->packrat == NULL) {
+    i->packrat_slots = mpc_packrat_slots_default;
+    i->packrat = calloc(i->packrat_slots, sizeof(mpc_packrat_entry_t));
+    i->packrat_lent = calloc(i->packrat_slots, sizeof(mpc_packrat_lent_t));
+  }
+  
+  return &i->packrat[
+    mpc_packrat_hash(key, i->state.pos) & (unsigned long)(i->packrat_slots-1)];
+}
+
+static mpc_packrat_lent_t *mpc_packrat_lent(mpc_input_t *i, mpc_val_t *x) {
+  return &i->packrat_lent[
+    mpc_packrat_hash(x, 0) & (unsigned long)(i->packrat_slots-1)];
+}
+
+static void mpc_packrat_lend(mpc_input_t *i, mpc_packrat_entry_t *m, mpc_val_t *x) {
+  mpc_packrat_lent_t *l;
+  m->output = NULL;
+  m->lent = x;
+  if (x == NULL || m->dx == NULL) { return; }
+  l = mpc_packrat_lent(i, x);
+  l->x = x;
+  l->slot = (int)(m - i->packrat);
+}
+
+/* A result which did not come from the table must never be taken back into it */
+static void mpc_packrat_forget(mpc_input_t *i, mpc_val_t *x) {
+  mpc_packrat_lent_t *l;
+  if (i->packrat == NULL || x == NULL) { return; }
+  l = mpc_packrat_lent(i, x);
+  if (l->x == x) { l->x = NULL; }
+}
+
+/*
+** Called with an output `p` has just produced and
+** which is about to be destroyed unused. If it is
+** what `p` last lent out it goes back in its entry.
+*/
+
+static int mpc_packrat_reclaim(mpc_input_t *i, mpc_parser_t *p, mpc_val_t *x) {
+  
+  mpc_packrat_lent_t *l;
+  mpc_packrat_entry_t *m;
+  
+  if (p->type != MPC_TYPE_PACKRAT || i->packrat == NULL || x == NULL) { return 0; }
+  
+  l = mpc_packrat_lent(i, x);
+  if (l->x != x) { return 0; }
+  
+  m = &i->packrat[l->slot];
+  if (m->key != mpc_packrat_key(p) || !m->success || m->lent != x) { return 0; }
+  
+  m->output = x;
+  m->lent = NULL;
+  l->x = NULL;
+  mpc_packrat_counts.reclaims++;
+  return 1;
+}
+
+static void mpc_packrat_dtor(mpc_input_t *i, mpc_parser_t *p, mpc_dtor_t d, mpc_val_t *x) {
+  if (!mpc_packrat_reclaim(i, p, x)) { mpc_parse_dtor(i, d, x); }
+}
+
+static int mpc_packrat_match(mpc_packrat_entry_t *m, void *key, long pos, int suppress) {
+  return m->key == key && m->pos == pos && m->suppress == suppress;
+}
+
+/*
+** Only string inputs can jump to an arbitrary
+** end position, and only while backtracking is
+** on is a failure guaranteed to leave the input
+** where it started. Anything else just runs the
+** inner parser.
+*/
+
+static int mpc_packrat_enabled(mpc_input_t *i) {
+  return i->type == MPC_INPUT_STRING && i->backtrack > 0;
+}
+
 enum {
   MPC_PARSE_STACK_MIN = 4
 };
@@ -981,6 +1208,10 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
   mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
   mpc_result_t *results;
   int results_slots = MPC_PARSE_STACK_MIN;
+  mpc_packrat_entry_t *memo;
+  mpc_err_t *merged;
+  long start;
+  int suppress;
   
   switch (p->type) {
       
@@ -1040,6 +1271,67 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
         MPC_FAILURE(r->error);
       }
     
+    case MPC_TYPE_PACKRAT:
+      
+      if (!mpc_packrat_enabled(i)) {
+        if (mpc_parse_run(i, p->data.packrat.x, r, e)) {
+          mpc_packrat_forget(i, r->output);
+          MPC_SUCCESS(r->output);
+        } else {
+          MPC_FAILURE(r->error);
+        }
+      }
+      
+      mpc_packrat_counts.lookups++;
+      start = i->state.pos;
+      suppress = i->suppress != 0;
+      memo = mpc_packrat_entry(i, mpc_packrat_key(p));
+      
+      /* A success still lent out elsewhere has to be parsed again */
+      if (mpc_packrat_match(memo, mpc_packrat_key(p), start, suppress)
+      && (!memo->success || memo->lent == NULL)) {
+        mpc_packrat_counts.hits++;
+        i->state = memo->state;
+        i->last = memo->last;
+        *e = mpc_err_merge(i, *e, mpc_err_copy(memo->merged));
+        if (memo->success) {
+          mpc_packrat_lend(i, memo, memo->output);
+          MPC_SUCCESS(memo->lent);
+        } else {
+          MPC_FAILURE(mpc_err_copy(memo->error));
+        }
+      }
+      
+      /* Collect the errors the inner parser merges so they can be replayed */
+      merged = *e;
+      *e = NULL;
+      j = mpc_parse_run(i, p->data.packrat.x, r, e);
+      
+      if (memo->key && !mpc_packrat_match(memo, mpc_packrat_key(p), start, suppress)) {
+        mpc_packrat_counts.evictions++;
+      }
+      mpc_packrat_clear(i, memo);
+      mpc_packrat_counts.stores++;
+      
+      memo->key = mpc_packrat_key(p);
+      memo->pos = start;
+      memo->suppress = suppress;
+      memo->success = j;
+      memo->state = i->state;
+      memo->last = i->last;
+      memo->dx = p->data.packrat.dx;
+      memo->merged = mpc_err_copy(*e);
+      *e = mpc_err_merge(i, merged, *e);
+      
+      if (j) {
+        mpc_packrat_forget(i, r->output);
+        mpc_packrat_lend(i, memo, r->output);
+        MPC_SUCCESS(r->output);
+      } else {
+        memo->error = mpc_err_copy(r->error);
+        MPC_FAILURE(r->error);
+      }
+    
     /* Optional Parsers */
     
     /* TODO: Update Not Error Message */
@@ -1050,7 +1342,7 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
       if (mpc_parse_run(i, p->data.not.x, r, e)) {
         mpc_input_rewind(i);
         mpc_input_suppress_disable(i);
-        mpc_parse_dtor(i, p->data.not.dx, r->output);
+        mpc_packrat_dtor(i, p->data.not.x, p->data.not.dx, r->output);
         MPC_FAILURE(mpc_err_new(i, "opposite"));
       } else {
         mpc_input_unmark(i);
@@ -1133,7 +1425,7 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
           if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
       } else {
         for (k = 0; k < j; k++) {
-          mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
+          mpc_packrat_dtor(i, p->data.repeat.x, p->data.repeat.dx, results[k].output);
         }
         MPC_FAILURE(
           mpc_err_count(i, results[j].error, p->data.repeat.n);
@@ -1175,7 +1467,7 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
         if (!mpc_parse_run(i, p->data.and.xs[j], &results[j], e)) {
           mpc_input_rewind(i);
           for (k = 0; k < j; k++) {
-            mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
+            mpc_packrat_dtor(i, p->data.and.xs[k], p->data.and.dxs[k], results[k].output);
           }
           MPC_FAILURE(results[j].error;
             if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
@@ -1222,6 +1514,14 @@ int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_res
   return x;
 }
 
+int mpc_parse_n(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_buffer(filename, string, length);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
+}
+
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_input_t *i = mpc_input_new_file(filename, file);
@@ -1298,6 +1598,7 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
     case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
     case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
+    case MPC_TYPE_PACKRAT:  mpc_undefine_unretained(p->data.packrat.x, 0);  break;
     
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1611,6 +1912,15 @@ mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
   return p;
 }
 
+mpc_parser_t *mpc_packrat(mpc_parser_t *a, mpc_dtor_t da) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_PACKRAT;
+  p->data.packrat.x = a;
+  p->data.packrat.dx = da;
+  p->data.packrat.key = NULL;
+  return p;
+}
+
 mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NOT;
@@ -2445,6 +2755,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_PACKRAT)  { mpc_print_unretained(p->data.packrat.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
   if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -2986,13 +3297,27 @@ static mpc_val_t *mpcaf_grammar_id(mpc_val_t *x, void *s) {
   
   mpca_grammar_st_t *st = s;
   mpc_parser_t *p = mpca_grammar_find_parser(x, st);
+  mpc_parser_t *r;
   free(x);
 
   if (p->name) {
-    return mpca_state(mpca_root(mpca_add_tag(p, p->name)));
+    r = mpca_state(mpca_root(mpca_add_tag(p, p->name)));
   } else {
     return mpca_state(mpca_root(p));
   }
+  
+  /*
+  ** Every reference to a rule builds the same wrapper,
+  ** so all of them share entries keyed on the rule's
+  ** name, which no parser can have as its own address.
+  */
+  
+  if (st->flags & MPCA_LANG_PACKRAT) {
+    r = mpc_packrat(r, (mpc_dtor_t)mpc_ast_delete);
+    r->data.packrat.key = p->name;
+  }
+  
+  return r;
 }
 
 mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
@@ -3332,6 +3657,7 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_PACKRAT)  { return 1 + mpc_nodecount_unretained(p->data.packrat.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE) { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
@@ -3379,6 +3705,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_optimise_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_optimise_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_optimise_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_PACKRAT)  { mpc_optimise_unretained(p->data.packrat.x, 0); }
   if (p->type == MPC_TYPE_NOT)      { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE)    { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MANY)     { mpc_optimise_unretained(p->data.repeat.x, 0); }
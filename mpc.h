@@ -61,6 +61,7 @@ struct mpc_parser_t;
 typedef struct mpc_parser_t mpc_parser_t;
 
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
+int mpc_parse_n(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
@@ -134,6 +135,33 @@ mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...);
 
 mpc_parser_t *mpc_predictive(mpc_parser_t *a);
 
+/*
+** Packrat Memoisation
+**
+** `mpc_packrat` remembers the result of `a` at
+** each input position, so backtracking into it
+** again costs nothing. Outputs are lent rather
+** than copied and `da` frees any the table is
+** left holding. The table keeps a bounded number
+** of entries per parse, set by `mpc_packrat_limit`.
+** Pipe inputs and predictive parsers are not
+** memoised.
+*/
+
+mpc_parser_t *mpc_packrat(mpc_parser_t *a, mpc_dtor_t da);
+
+typedef struct {
+  long lookups;
+  long hits;
+  long stores;
+  long evictions;
+  long reclaims;
+} mpc_packrat_stats_t;
+
+void mpc_packrat_limit(int slots);
+void mpc_packrat_stats(mpc_packrat_stats_t *s);
+void mpc_packrat_stats_reset(void);
+
 /*
 ** Common Parsers
 */
@@ -303,7 +331,8 @@ mpc_parser_t *mpca_and(int n, ...);
 enum {
   MPCA_LANG_DEFAULT              = 0,
   MPCA_LANG_PREDICTIVE           = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_PACKRAT              = 4
 };
 
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
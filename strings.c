@@ -7,48 +7,793 @@
 const char *VERSION_STRING = "0.14.0";
 
 // Lisp Environment
+// Once a frame grows past LENV_INDEX_MIN bindings (in practice the global
+// environment) it also keeps an open-addressing hash index into syms/vals.
 struct lenv {
     lenv *par;
     int count;
-    char **syms;
+    char **syms;    // interned names, see lsym_intern()
     lval **vals;
+
+    int *index;     // position in syms + 1, or 0 for an empty slot
+    int index_slots;
+
+    int gc;         // collector flags, see GARBAGE COLLECTOR
 };
 
 // LVAL: Lisp Value
+// Heap values are a tag plus a union sized to the largest variant (functions).
+// Numbers that fit in a fixnum and booleans never reach the heap at all: they
+// are encoded directly in the lval pointer, see the LVAL IMMEDIATES section.
+// Heap values are shared and traced by the collector, see SHARING and
+// GARBAGE COLLECTOR below.
 struct lval {
     int type;
+    int gc;
+
+    union {
+        // Where a collected nursery value was moved to
+        lval *forward;
+
+        // Basic
+        long num;
+        double dbl;
+
+        // String or Error of slen bytes in the buffer of sbase, or of this
+        // value if sbase is NULL, see STRING BUFFERS
+        struct {
+            char *str;
+            int slen;
+            unsigned shash;     // once GC_HASHED, see HASH MAPS
+            lval *sbase;
+        };
+
+        // Short String or Error kept in the value itself (GC_INLINE)
+        struct {
+            char sso[LVAL_SSO_MAX + 1];
+            unsigned char ssolen;
+        };
+
+        // Symbol resolved to a slot of the frame it is evaluated in
+        struct {
+            char *sym;
+            int slot;
+        };
+
+        // Function
+        struct {
+            lbuiltin builtin;
+            lenv *env;
+            lval *formals;
+            lval *body;
+        };
+
+        // Expression, with the bytecode compiled from it if it is a body.
+        // A view shares count cells of the storage of its base list
+        struct {
+            int count;
+            unsigned hash;      // of the cells once GC_HASHED, see HASH MAPS
+            lval **cell;
+            lcode *code;
+            lval *base;
+        };
+
+        // Big Number, blen limbs of 32 bits, least significant first,
+        // see BIGNUMS
+        struct {
+            int bsign;
+            int blen;
+            uint32_t *limbs;
+        };
+
+        // Typed Array of alen elements of kind ARR_I64 or ARR_F64, see
+        // TYPED ARRAYS
+        struct {
+            int alen;
+            int akind;
+            void *adata;
+        };
+
+        // Vector, with room for cap items
+        struct {
+            int len;
+            int cap;
+            lval **items;
+        };
+
+        // Cache of a memoised function, see MEMOISATION
+        lmemo *memo;
+
+        // Hash map, table holds key, value pairs for mask + 1 slots
+        struct {
+            int size;       // live keys
+            int filled;     // live keys and tombstones
+            int mask;
+            lval **table;
+        };
+    };
+};
+
+// Storage shared by a string and every string built on or cut from it
+typedef struct {
+    int cap;        // bytes of data, with room for a NUL after them
+    int used;       // bytes written, the rest is free for appending
+    char data[];
+} lstrbuf;
 
-    // Basic
-    bool truth_value;
-    long num;
-    char *err;
-    char *sym;
-    char *str;
+// The buffer of a string that owns one
+static inline lstrbuf *lval_strbuf(lval *owner) {
+    return (lstrbuf*)(owner->str - offsetof(lstrbuf, data));
+}
+
+// A global binding remembered by one OP_LOOKUP, see INLINE CACHES
+typedef struct {
+    unsigned long version;
+    lval *val;
+} lcache;
 
-    // Function
-    lbuiltin builtin;
-    lenv *env;
-    lval *formals;
-    lval *body;
+// Bytecode compiled from a lambda body, see BYTECODE COMPILER
+struct lcode {
+    int *ops;
+    int count;
+    lval **consts;
+    int nconsts;
+    lcache *caches;
+    int ncaches;
+    int depth;      // stack depth while compiling
+    int max_depth;
+};
 
+// One remembered call of a memoised function, see MEMOISATION
+typedef struct {
+    unsigned long hash;
+    lval *args;
+    lval *val;
+    int chain;          // next entry in the same bucket, or -1
+    int older, newer;   // neighbours in recency order, or -1
+} lmemo_entry;
+
+// The cache of a memoised function
+struct lmemo {
+    int cap;
     int count;
-    lval **cell;
+    int mask;           // buckets - 1
+    int *buckets;       // first entry of each bucket, or -1
+    lmemo_entry *entries;
+    int newest, oldest;
+    long hits, misses, evictions;
+};
+
+
+/* * * * * * * * * * *
+*  LVAL IMMEDIATES  *
+* * * * * * * * * * */
+// lval pointers are at least 8-byte aligned, which leaves the low bits free:
+//   ...1  fixnum, the number lives in the upper bits
+//   ..10  boolean, bit 2 holds the truth value
+//   .100  symbol, the upper bits point at its interned name
+//   .000  pointer to a heap allocated lval
+
+lval *lval_true  = (lval*)(intptr_t)0x6;
+lval *lval_false = (lval*)(intptr_t)0x2;
+
+// Marks a deleted key in a hash map's table, and is never a value itself
+lval *lval_tomb = (lval*)(intptr_t)0xA;
+
+static inline int lval_is_fixnum(lval *v) { return ((intptr_t)v & 1) != 0; }
+static inline int lval_is_bool(lval *v) { return ((intptr_t)v & 3) == 2; }
+// Only true for plain symbols, slot symbols are boxed with type LVAL_SYM
+static inline int lval_is_sym(lval *v) { return ((intptr_t)v & 7) == 4; }
+static inline int lval_is_immediate(lval *v) { return ((intptr_t)v & 7) != 0; }
+
+static inline int lval_type(lval *v) {
+    if (lval_is_fixnum(v)) { return LVAL_NUM; }
+    if (lval_is_bool(v)) { return LVAL_BOOL; }
+    if (lval_is_sym(v)) { return LVAL_SYM; }
+    return v->type;
+}
+
+static inline long lval_to_num(lval *v) {
+    if (lval_is_fixnum(v)) { return (long)((intptr_t)v >> 1); }
+    return v->num;
+}
+
+static inline bool lval_truth(lval *v) { return v == lval_true; }
+
+// The interned name of a symbol. Equal names are always the same pointer.
+static inline char *lval_to_sym(lval *v) {
+    if (!lval_is_sym(v)) { return v->sym; }
+    return (char*)((intptr_t)v & ~(intptr_t)7);
+}
+
+
+/* * * * * * * * *
+*  SYMBOL TABLE  *
+* * * * * * * * */
+// Every symbol name is stored exactly once. Names are never freed, so
+// symbols can be copied and compared by pointer everywhere else.
+
+typedef struct lsym {
+    unsigned long hash;
+    size_t len;
+    long local;     // ever bound in a frame, see INLINE CACHES
+    char name[];    // 8-byte aligned, see LVAL IMMEDIATES
+} lsym;
+
+lsym **lsym_table = NULL;
+int lsym_count = 0;
+int lsym_slots = 0;
+
+// Frequently compared symbols, interned by lsym_init()
+char *lsym_amp;
+char *lsym_if;
+
+unsigned long lsym_hash_n(char *s, size_t n) {
+    // FNV-1a
+    unsigned long h = 2166136261UL;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+unsigned long lsym_hash(char *s) { return lsym_hash_n(s, strlen(s)); }
+
+void lsym_grow(void) {
+    int slots = lsym_slots ? lsym_slots * 2 : 256;
+    lsym **table = calloc(slots, sizeof(lsym*));
+
+    // Re-insert every existing name into the larger table
+    for (int i = 0; i < lsym_slots; i++) {
+        if (!lsym_table[i]) { continue; }
+        int j = lsym_table[i]->hash & (slots - 1);
+        while (table[j]) { j = (j + 1) & (slots - 1); }
+        table[j] = lsym_table[i];
+    }
+
+    free(lsym_table);
+    lsym_table = table;
+    lsym_slots = slots;
+}
+
+// Hash of an interned name, computed once when it was interned
+static inline unsigned long lsym_hash_of(char *name) {
+    return ((lsym*)(name - offsetof(lsym, name)))->hash;
+}
+
+char *lsym_intern(char *s) { return lsym_intern_n(s, strlen(s)); }
+
+// Intern the n bytes at s, which need not be followed by a NUL
+char *lsym_intern_n(char *s, size_t len) {
+    // Keep the load factor under one half
+    if ((lsym_count + 1) * 2 > lsym_slots) { lsym_grow(); }
+
+    unsigned long h = lsym_hash_n(s, len);
+    int i = h & (lsym_slots - 1);
+
+    // Linear probe until we find the name or an empty slot
+    while (lsym_table[i]) {
+        if (lsym_table[i]->hash == h && lsym_table[i]->len == len
+            && memcmp(lsym_table[i]->name, s, len) == 0) {
+            return lsym_table[i]->name;
+        }
+        i = (i + 1) & (lsym_slots - 1);
+    }
+
+    lsym *sym = malloc(sizeof(lsym) + len + 1);
+    sym->hash = h;
+    sym->len = len;
+    sym->local = 0;
+    memcpy(sym->name, s, len);
+    sym->name[len] = '\0';
+
+    lsym_table[i] = sym;
+    lsym_count++;
+    return sym->name;
+}
+
+void lsym_init(void) {
+    lsym_amp = lsym_intern("&");
+    lsym_if = lsym_intern("if");
+}
+
+/* * * * * * * * * * *
+*  POOL ALLOCATOR  *
+* * * * * * * * * * */
+// Old values and environments come from fixed size pools, and cell, syms and
+// vals arrays from pools of power-of-two sizes. Pools are carved out of
+// POOL_SLAB_BYTES slabs and recycled through free lists threaded through the
+// free blocks. An array of n pointers always lives in the smallest class that
+// fits n, so callers pass the count along instead of it being stored, and
+// growing by one only moves the array when it crosses a power of two.
+// Arrays longer than POOL_ARRAY_MAX go straight to malloc.
+//
+// Build with -DPOOL_MALLOC to use plain malloc for everything instead.
+
+typedef struct pool {
+    size_t size;        // block size in bytes
+    void *free;         // next free block, each one points to the next
+    long used;          // blocks handed out
+    long blocks;        // blocks carved from slabs so far
+    long requested;     // bytes of the used blocks actually asked for
+} pool;
+
+pool pool_lval = { sizeof(lval) };
+pool pool_lenv = { sizeof(lenv) };
+pool pool_arrays[POOL_ARRAY_CLASSES];
+
+void pool_init(void) {
+    for (int c = 0; c < POOL_ARRAY_CLASSES; c++) {
+        pool_arrays[c].size = sizeof(void*) << c;
+    }
+}
+
+void pool_refill(pool *p) {
+    long n = POOL_SLAB_BYTES / p->size;
+    if (n == 0) { n = 1; }
+
+    // Thread the new blocks onto the free list, first block first
+    char *slab = malloc(n * p->size);
+    for (long i = n - 1; i >= 0; i--) {
+        void *b = slab + i * p->size;
+        *(void**)b = p->free;
+        p->free = b;
+    }
+    p->blocks += n;
+}
+
+void *pool_alloc(pool *p) {
+    p->used++;
+#ifdef POOL_MALLOC
+    p->blocks++;
+    return malloc(p->size);
+#else
+    if (!p->free) { pool_refill(p); }
+    void *b = p->free;
+    p->free = *(void**)b;
+    return b;
+#endif
+}
+
+void pool_free(pool *p, void *b) {
+    p->used--;
+#ifdef POOL_MALLOC
+    p->blocks--;
+    free(b);
+#else
+    *(void**)b = p->free;
+    p->free = b;
+#endif
+}
+
+// Smallest class holding n pointers
+static inline int pool_class(int n) {
+    int c = 0;
+    while ((1 << c) < n) { c++; }
+    return c;
+}
+
+static inline int pool_pooled(int n) {
+#ifdef POOL_MALLOC
+    return 0;
+#else
+    return n <= POOL_ARRAY_MAX;
+#endif
+}
+
+// Room for n pointers, NULL if n is 0
+void *pool_array_alloc(int n) {
+    if (n == 0) { return NULL; }
+    if (!pool_pooled(n)) { return malloc(sizeof(void*) * n); }
+
+    pool *p = &pool_arrays[pool_class(n)];
+    p->requested += sizeof(void*) * n;
+    return pool_alloc(p);
+}
+
+void pool_array_free(void *a, int n) {
+    if (n == 0) { return; }
+    if (!pool_pooled(n)) { free(a); return; }
+
+    pool *p = &pool_arrays[pool_class(n)];
+    p->requested -= sizeof(void*) * n;
+    pool_free(p, a);
+}
+
+// Resize an array of 'old' pointers to hold n, keeping its contents
+void *pool_array_resize(void *a, int old, int n) {
+    if (old > 0 && n > 0) {
+        if (!pool_pooled(old) && !pool_pooled(n)) {
+            return realloc(a, sizeof(void*) * n);
+        }
+        if (pool_pooled(old) && pool_pooled(n)
+            && pool_class(old) == pool_class(n)) {
+            pool_arrays[pool_class(n)].requested += sizeof(void*) * (n - old);
+            return a;
+        }
+    }
+
+    void *b = pool_array_alloc(n);
+    if (b && a) { memcpy(b, a, sizeof(void*) * (old < n ? old : n)); }
+    pool_array_free(a, old);
+    return b;
+}
+
+/* * * * * * * * * * * *
+*  GARBAGE COLLECTOR  *
+* * * * * * * * * * * */
+// Values are allocated by bumping a pointer through the nursery. Once it is
+// full the next lval_eval runs a minor collection: everything still reachable
+// is copied out into the old generation and the nursery starts over, so the
+// many values that die young cost nothing to reclaim. Old values are only
+// traced by a major collection, once the old generation has doubled.
+//
+// The roots are the global environment and whatever locals the evaluator has
+// registered with gc_root() while it works on them. Environments never move.
+// Storing a value into an old value or environment must be followed by
+// gc_write() / gc_write_env() so that minor collections look there too.
+
+enum {
+    GC_SHARED     = 1,   // a second reference was taken at some point
+    GC_OLD        = 2,   // lives in the old generation
+    GC_MARK       = 4,   // reached by the current collection
+    GC_REMEMBERED = 8,   // old and written to since the last collection
+    GC_FORWARDED  = 16,  // nursery copy of a value that was moved
+    GC_FREED      = 32,  // storage already given back by lval_del
+    GC_STACK      = 64,  // activation frame on the C stack, never freed
+    GC_INLINE     = 128, // not collector state: a string held in the value
+    GC_HASHED     = 256  // not collector state: its structural hash is known
 };
 
+// Growable array of pointers
+typedef struct {
+    void **items;
+    int count;
+    int size;
+} gc_vec;
+
+void gc_vec_push(gc_vec *v, void *x) {
+    if (v->count == v->size) {
+        v->size = v->size ? v->size * 2 : 256;
+        v->items = realloc(v->items, sizeof(void*) * v->size);
+    }
+    v->items[v->count++] = x;
+}
+
+gc_vec gc_chunks;           // nursery chunks of GC_NURSERY_LVALS values
+int gc_top = GC_NURSERY_LVALS;  // next free value in the last chunk
+int gc_pending = 0;         // collect at the next safepoint
+
+gc_vec gc_old;              // every old value
+gc_vec gc_envs;             // every environment
+int gc_envs_young = 0;      // gc_envs from here on are young
+int gc_major_at = GC_OLD_MIN;
+
+gc_vec gc_roots;            // lval** of registered locals
+gc_vec gc_root_envs;
+gc_vec gc_remembered;
+gc_vec gc_remembered_envs;
+gc_vec gc_work;             // values reached but not yet scanned
+int gc_major_pass = 0;
+
+struct {
+    long minor;
+    long major;
+    long allocated;
+    long promoted;
+    double pause_total;     // seconds
+    double pause_max;
+} gc_stats;
+
+lval *gc_alloc(void) {
+    if (gc_top == GC_NURSERY_LVALS) {
+        // Carry on in a fresh chunk, allocation itself never collects
+        if (gc_chunks.count) { gc_pending = 1; }
+        gc_vec_push(&gc_chunks, malloc(sizeof(lval) * GC_NURSERY_LVALS));
+        gc_top = 0;
+    }
+    gc_stats.allocated++;
+    lval *chunk = gc_chunks.items[gc_chunks.count-1];
+    return &chunk[gc_top++];
+}
+
+void gc_root(lval **v) { gc_vec_push(&gc_roots, v); }
+void gc_unroot(int n) { gc_roots.count -= n; }
+void gc_root_env(lenv *e) { gc_vec_push(&gc_root_envs, e); }
+void gc_unroot_env(void) { gc_root_envs.count--; }
+
+void gc_track_env(lenv *e) {
+    e->gc = 0;
+    gc_vec_push(&gc_envs, e);
+}
+
+// Write barriers: remember old objects that may now point into the nursery
+void gc_write(lval *v) {
+    if ((v->gc & (GC_OLD | GC_REMEMBERED)) == GC_OLD) {
+        v->gc |= GC_REMEMBERED;
+        gc_vec_push(&gc_remembered, v);
+    }
+}
+
+void gc_write_env(lenv *e) {
+    if ((e->gc & (GC_OLD | GC_REMEMBERED)) == GC_OLD) {
+        e->gc |= GC_REMEMBERED;
+        gc_vec_push(&gc_remembered_envs, e);
+    }
+}
+
+// Make *slot point at a live copy of its value, promoting it if it is young
+void gc_visit(lval **slot) {
+    lval *v = *slot;
+    if (!v || lval_is_immediate(v)) { return; }
+
+    if (v->gc & GC_OLD) {
+        // Old values are only traced in a major collection
+        if (gc_major_pass && !(v->gc & GC_MARK)) {
+            v->gc |= GC_MARK;
+            gc_vec_push(&gc_work, v);
+        }
+        return;
+    }
+
+    if (v->gc & GC_FORWARDED) { *slot = v->forward; return; }
+
+    lval *n = pool_alloc(&pool_lval);
+    *n = *v;
+    n->gc = (v->gc & (GC_SHARED | GC_FREED | GC_INLINE | GC_HASHED)) | GC_OLD
+          | (gc_major_pass ? GC_MARK : 0);
+    v->gc |= GC_FORWARDED;
+    v->forward = n;
+
+    gc_vec_push(&gc_old, n);
+    gc_vec_push(&gc_work, n);
+    gc_stats.promoted++;
+    *slot = n;
+}
+
+void gc_visit_env(lenv *e) {
+    // Stack frames are only reachable as roots, and never marked
+    if (e->gc & GC_STACK) {
+        for (int i = 0; i < e->count; i++) { gc_visit(&e->vals[i]); }
+        return;
+    }
+    if (e->gc & GC_MARK) { return; }
+    if ((e->gc & GC_OLD) && !gc_major_pass) { return; }
+    e->gc |= GC_MARK;
+    for (int i = 0; i < e->count; i++) { gc_visit(&e->vals[i]); }
+}
+
+void gc_scan(lval *v) {
+    if (v->gc & GC_FREED) { return; }
+    switch (v->type) {
+        case LVAL_STR:
+        case LVAL_ERR:
+            if (!(v->gc & GC_INLINE) && v->sbase) { gc_visit(&v->sbase); }
+            break;
+        case LVAL_FUN:
+            if (!v->builtin) {
+                if (v->env) { gc_visit_env(v->env); }
+                gc_visit(&v->formals);
+                gc_visit(&v->body);
+            } else if (v->builtin == builtin_memoised) {
+                gc_visit(&v->formals);
+                gc_visit(&v->body);
+            }
+            break;
+        case LVAL_MEMO:
+            for (int i = 0; i < v->memo->count; i++) {
+                gc_visit(&v->memo->entries[i].args);
+                gc_visit(&v->memo->entries[i].val);
+            }
+            break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            // A view's cells belong to its base, and its storage never moves
+            if (v->base) {
+                gc_visit(&v->base);
+            } else {
+                for (int i = 0; i < v->count; i++) { gc_visit(&v->cell[i]); }
+            }
+            if (v->code) {
+                for (int i = 0; i < v->code->nconsts; i++) {
+                    gc_visit(&v->code->consts[i]);
+                }
+            }
+            break;
+        case LVAL_VEC:
+            for (int i = 0; i < v->len; i++) { gc_visit(&v->items[i]); }
+            break;
+        case LVAL_MAP:
+            // Empty slots and tombstones are skipped by gc_visit
+            for (int i = 0; i < 2 * (v->mask + 1); i++) {
+                gc_visit(&v->table[i]);
+            }
+            break;
+    }
+}
+
+// Free whatever a dead value owns apart from other values
+void gc_finalize(lval *v) {
+    if (v->gc & (GC_FORWARDED | GC_FREED)) { return; }
+    switch (v->type) {
+        case LVAL_ERR:
+        case LVAL_STR:
+            if (!(v->gc & GC_INLINE) && !v->sbase) { free(lval_strbuf(v)); }
+            break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            if (!v->base) { pool_array_free(v->cell, v->count); }
+            if (v->code) { lcode_del(v->code); }
+            break;
+        case LVAL_VEC: pool_array_free(v->items, v->cap); break;
+        case LVAL_MAP: pool_array_free(v->table, 2 * (v->mask + 1)); break;
+        case LVAL_BIG: free(v->limbs); break;
+        case LVAL_ARR: free(v->adata); break;
+        case LVAL_MEMO: lmemo_del(v->memo); break;
+    }
+}
+
+void gc_finalize_env(lenv *e) {
+    pool_array_free(e->syms, e->count);
+    pool_array_free(e->vals, e->count);
+    free(e->index);
+    pool_free(&pool_lenv, e);
+}
+
+void gc_collect(void) {
+    clock_t start = clock();
+    gc_pending = 0;
+    lenv_version++;
+    gc_major_pass = gc_old.count >= gc_major_at;
+
+    for (int i = 0; i < gc_roots.count; i++) { gc_visit(gc_roots.items[i]); }
+    for (int i = 0; i < vm_sp; i++) { gc_visit(&vm_stack[i]); }
+    for (int i = 0; i < gc_root_envs.count; i++) { gc_visit_env(gc_root_envs.items[i]); }
+
+    // A major collection traces the old generation anyway
+    for (int i = 0; i < gc_remembered.count; i++) {
+        lval *v = gc_remembered.items[i];
+        v->gc &= ~GC_REMEMBERED;
+        if (!gc_major_pass) { gc_scan(v); }
+    }
+    for (int i = 0; i < gc_remembered_envs.count; i++) {
+        lenv *e = gc_remembered_envs.items[i];
+        e->gc &= ~GC_REMEMBERED;
+        if (gc_major_pass) { continue; }
+        for (int j = 0; j < e->count; j++) { gc_visit(&e->vals[j]); }
+    }
+    gc_remembered.count = 0;
+    gc_remembered_envs.count = 0;
+
+    while (gc_work.count) { gc_scan(gc_work.items[--gc_work.count]); }
+
+    // Whatever is left in the nursery is garbage
+    for (int c = 0; c < gc_chunks.count; c++) {
+        lval *chunk = gc_chunks.items[c];
+        int n = (c == gc_chunks.count - 1) ? gc_top : GC_NURSERY_LVALS;
+        for (int i = 0; i < n; i++) { gc_finalize(&chunk[i]); }
+        if (c > 0) { free(chunk); }
+    }
+    gc_chunks.count = 1;
+    gc_top = 0;
+
+    if (gc_major_pass) {
+        int live = 0;
+        for (int i = 0; i < gc_old.count; i++) {
+            lval *v = gc_old.items[i];
+            if (v->gc & GC_MARK) {
+                v->gc &= ~GC_MARK;
+                gc_old.items[live++] = v;
+            } else {
+                gc_finalize(v);
+                pool_free(&pool_lval, v);
+            }
+        }
+        gc_old.count = live;
+        gc_major_at = live * 2 > GC_OLD_MIN ? live * 2 : GC_OLD_MIN;
+    }
+
+    // Surviving environments are old from now on
+    int live = gc_major_pass ? 0 : gc_envs_young;
+    for (int i = live; i < gc_envs.count; i++) {
+        lenv *e = gc_envs.items[i];
+        if (e->gc & GC_MARK) {
+            e->gc = GC_OLD;
+            gc_envs.items[live++] = e;
+        } else {
+            gc_finalize_env(e);
+        }
+    }
+    gc_envs.count = live;
+    gc_envs_young = live;
+
+    double pause = (double)(clock() - start) / CLOCKS_PER_SEC;
+    gc_stats.pause_total += pause;
+    if (pause > gc_stats.pause_max) { gc_stats.pause_max = pause; }
+    if (gc_major_pass) { gc_stats.major++; } else { gc_stats.minor++; }
+}
 
 /* * * * * * * * * * * * *
 * LENV HELPER FUNCTIONS *
 * * * * * * * * * * * * */
 
-lenv *lenv_new(void) {
-    lenv *e = malloc(sizeof(lenv));
+void lenv_init(lenv *e) {
     e->par = NULL;
     e->count = 0;
     e->syms = NULL;
     e->vals = NULL;
+    e->index = NULL;
+    e->index_slots = 0;
+}
+
+lenv *lenv_new(void) {
+    lenv *e = pool_alloc(&pool_lenv);
+    lenv_init(e);
+    gc_track_env(e);
     return e;
 }
 
+// Set up an activation frame living on the C stack. The collector never
+// frees it, and scans it in full while it is registered as a root.
+void lenv_frame(lenv *e, lenv *par) {
+    lenv_init(e);
+    e->par = par;
+    e->gc = GC_STACK;
+}
+
+// Add binding 'pos' to the hash index
+void lenv_index_add(lenv *e, int pos) {
+    int mask = e->index_slots - 1;
+    int i = lsym_hash_of(e->syms[pos]) & mask;
+    while (e->index[i]) { i = (i + 1) & mask; }
+    e->index[i] = pos + 1;
+}
+
+// (Re)build the hash index, leaving room for the frame to double
+void lenv_index(lenv *e) {
+    free(e->index);
+    e->index_slots = 64;
+    while (e->index_slots < e->count * 4) { e->index_slots *= 2; }
+    e->index = calloc(e->index_slots, sizeof(int));
+    for (int i = 0; i < e->count; i++) { lenv_index_add(e, i); }
+}
+
+// Position of 'sym' among the bindings of 'e' itself, or -1
+int lenv_find(lenv *e, char *sym) {
+    if (e->index) {
+        int mask = e->index_slots - 1;
+        int i = lsym_hash_of(sym) & mask;
+        while (e->index[i]) {
+            int pos = e->index[i] - 1;
+            if (e->syms[pos] == sym) { return pos; }
+            i = (i + 1) & mask;
+        }
+        return -1;
+    }
+
+    // Small frames are quicker to scan than to hash
+    for (int i = 0; i < e->count; i++) {
+        // Interned names match only if they are the same pointer
+        if (e->syms[i] == sym) { return i; }
+    }
+    return -1;
+}
+
+// Put the frame next, whose parent is e, in the place of e for a tail call.
+// Bindings of e that next does not rebind are carried over, so every lookup
+// finds what it would have found through next->par.
+void lenv_replace(lenv *e, lenv *next) {
+    for (int i = 0; i < e->count; i++) {
+        if (lenv_find(next, e->syms[i]) < 0) {
+            lenv_put_sym(next, e->syms[i], e->vals[i]);
+        }
+    }
+    next->par = e->par;
+    lenv_del(e);
+    *e = *next;
+}
+
 void lenv_def(lenv *e, lval *k, lval *v) {
     // Iterate till e has no parent
     while (e->par) { e = e->par; }
@@ -56,69 +801,133 @@ void lenv_def(lenv *e, lval *k, lval *v) {
     lenv_put(e, k, v);
 }
 
+// Release the bindings of e early, the collector frees e itself
 void lenv_del(lenv *e) {
+    // Symbol names are interned, only the values are owned
     for (int i = 0; i < e->count; i++) {
-        free(e->syms[i]);
         lval_del(e->vals[i]);
     }
-    free(e->syms);
-    free(e->vals);
-    free(e);
+    pool_array_free(e->syms, e->count);
+    pool_array_free(e->vals, e->count);
+    free(e->index);
+    e->count = 0;
+    e->syms = NULL;
+    e->vals = NULL;
+    e->index = NULL;
 }
 
 lenv *lenv_copy(lenv *e) {
-    lenv *n = malloc(sizeof(lenv));
+    lenv *n = pool_alloc(&pool_lenv);
     n->par = e->par;
     n->count = e->count;
-    n->syms = malloc(sizeof(char*) * n->count);
-    n->vals = malloc(sizeof(lval*) * n->count);
+    n->syms = pool_array_alloc(n->count);
+    n->vals = pool_array_alloc(n->count);
     for (int i = 0; i < e->count; i++) {
-        n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-        strcpy(n->syms[i], e->syms[i]);
+        n->syms[i] = e->syms[i];
         n->vals[i] = lval_copy(e->vals[i]);
     }
+    n->index = NULL;
+    n->index_slots = 0;
+    if (n->count >= LENV_INDEX_MIN) { lenv_index(n); }
+    gc_track_env(n);
     return n;
 }
 
 lval *lenv_get(lenv *e, lval *k) {
-    // Iterate over all items in environment
-    for (int i = 0; i < e->count; i++) {
-        // Check if the stored string matches the symbol string
-        // If it does, return a copy of the value
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            return lval_copy(e->vals[i]);
-        }
+    char *sym = lval_to_sym(k);
+
+    // A slot symbol knows where it is bound in the frame it is evaluated in,
+    // as long as that frame really is the one it was resolved against
+    if (!lval_is_sym(k) && k->slot < e->count && e->syms[k->slot] == sym) {
+        return lval_copy(e->vals[k->slot]);
     }
-    // If no symbol found check it parent, otherwise return an error
-    if (e->par) {
-        return lenv_get(e->par, k);
-    } else {
-        return lval_err("Unbound symbol '%s'", k->sym);
+
+    // Walk this environment and then each parent in turn, returning
+    // the first value bound to the symbol (a copy only shares it)
+    for (lenv *f = e; f; f = f->par) {
+        int i = lenv_find(f, sym);
+        if (i >= 0) { return lval_copy(f->vals[i]); }
     }
+    return lval_err("Unbound symbol '%s'", sym);
 }
 
-void lenv_put(lenv *e, lval *k, lval *v) {
+/* * * * * * * * * * *
+*  INLINE CACHES  *
+* * * * * * * * * * */
+// Each OP_LOOKUP remembers the value it found in the global environment,
+// tagged with lenv_version. Every global binding bumps the version, and so
+// does every collection, as it may move the values caches point at. While
+// the tags match, a lookup is a compare and a load.
+//
+// Free variables are dynamically scoped, so a frame anywhere up the chain
+// could hide a global. Only names that no frame has ever bound are cached:
+// the first time a frame binds a name it is marked local for good, and the
+// version is bumped so caches made before then are dropped.
+
+unsigned long lenv_version = 1;
+
+// lenv_get, filling ic if k turns out to be bound in the global environment
+lval *lenv_get_cached(lenv *e, lval *k, lcache *ic) {
+    char *sym = lval_to_sym(k);
+    if (!lval_is_sym(k) || ((lsym*)(sym - offsetof(lsym, name)))->local) {
+        return lenv_get(e, k);
+    }
 
-    // Iterate over all items in environment
-    // to see if variable already exists
-    for (int i = 0; i < e->count; i++) {
+    for (lenv *f = e; f; f = f->par) {
+        int i = lenv_find(f, sym);
+        if (i < 0) { continue; }
+        if (!f->par) {
+            ic->version = lenv_version;
+            ic->val = f->vals[i];
+        }
+        return lval_copy(f->vals[i]);
+    }
+    return lval_err("Unbound symbol '%s'", sym);
+}
+
+void lenv_put(lenv *e, lval *k, lval *v) {
+    lenv_put_sym(e, lval_to_sym(k), v);
+}
 
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
+void lenv_put_sym(lenv *e, char *sym, lval *v) {
+    // A global binding may change what cached lookups should see, and a name
+    // bound in a frame can never be cached again
+    if (!e->par) {
+        lenv_version++;
+    } else {
+        lsym *s = (lsym*)(sym - offsetof(lsym, name));
+        if (!s->local) {
+            s->local = 1;
+            lenv_version++;
         }
     }
 
+    // See if variable already exists
+    int i = lenv_find(e, sym);
+    if (i >= 0) {
+        lval *old = e->vals[i];
+        e->vals[i] = lval_copy(v);
+        gc_write_env(e);
+        lval_del(old);
+        return;
+    }
+
     // If no existing entry found, allocate space for new entry
+    e->vals = pool_array_resize(e->vals, e->count, e->count + 1);
+    e->syms = pool_array_resize(e->syms, e->count, e->count + 1);
     e->count++;
-    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
 
-    // Copy contents of lval and symbol string into new location
+    // Copy contents of lval and store the interned name
     e->vals[e->count-1] = lval_copy(v);
-    e->syms[e->count-1] = malloc(strlen(k->sym)+1);
-    strcpy(e->syms[e->count-1], k->sym);
+    e->syms[e->count-1] = sym;
+    gc_write_env(e);
+
+    // Keep the index under half full, or start one once the frame is big
+    if (e->index && e->count * 2 <= e->index_slots) {
+        lenv_index_add(e, e->count-1);
+    } else if (e->count >= LENV_INDEX_MIN) {
+        lenv_index(e);
+    }
 }
 
 void lenv_print(lenv *e) {
@@ -140,6 +949,7 @@ void lenv_add_builtins(lenv *e) {
     lenv_add_builtin(e, "load", builtin_load);
     lenv_add_builtin(e, "print", builtin_print);
     lenv_add_builtin(e, "error", builtin_error);
+    lenv_add_builtin(e, "substr", builtin_substr);
 
     // List Functions
     lenv_add_builtin(e, "list", builtin_list);
@@ -150,6 +960,68 @@ void lenv_add_builtins(lenv *e) {
     lenv_add_builtin(e, "len",  builtin_len);
     lenv_add_builtin(e, "cons", builtin_cons);
     lenv_add_builtin(e, "init", builtin_init);
+    lenv_add_builtin(e, "nth", builtin_nth);
+    lenv_add_builtin(e, "last", builtin_last);
+    lenv_add_builtin(e, "map", builtin_map);
+    lenv_add_builtin(e, "filter", builtin_filter);
+    lenv_add_builtin(e, "reverse", builtin_reverse);
+    lenv_add_builtin(e, "foldl", builtin_foldl);
+    lenv_add_builtin(e, "foldr", builtin_foldr);
+    lenv_add_builtin(e, "take", builtin_take);
+    lenv_add_builtin(e, "drop", builtin_drop);
+    lenv_add_builtin(e, "elem", builtin_elem);
+    lenv_add_builtin(e, "lookup", builtin_lookup);
+    lenv_add_builtin(e, "zip", builtin_zip);
+    lenv_add_builtin(e, "unzip", builtin_unzip);
+
+    // Vector Functions
+    lenv_add_builtin(e, "vec", builtin_vec);
+    lenv_add_builtin(e, "vmake", builtin_vmake);
+    lenv_add_builtin(e, "vlist", builtin_vlist);
+    lenv_add_builtin(e, "vlen", builtin_vlen);
+    lenv_add_builtin(e, "vget", builtin_vget);
+    lenv_add_builtin(e, "vset", builtin_vset);
+    lenv_add_builtin(e, "vpush", builtin_vpush);
+    lenv_add_builtin(e, "vslice", builtin_vslice);
+    lenv_add_builtin(e, "vconcat", builtin_vconcat);
+
+    // Hash Map Functions
+    lenv_add_builtin(e, "hmap", builtin_hmap);
+    lenv_add_builtin(e, "hset-of", builtin_hsetof);
+    lenv_add_builtin(e, "hget", builtin_hget);
+    lenv_add_builtin(e, "hhas", builtin_hhas);
+    lenv_add_builtin(e, "hset", builtin_hset);
+    lenv_add_builtin(e, "hdel", builtin_hdel);
+    lenv_add_builtin(e, "hkeys", builtin_hkeys);
+    lenv_add_builtin(e, "hvals", builtin_hvals);
+    lenv_add_builtin(e, "hsize", builtin_hsize);
+    lenv_add_builtin(e, "hunion", builtin_hunion);
+    lenv_add_builtin(e, "hinter", builtin_hinter);
+    lenv_add_builtin(e, "hdiff", builtin_hdiff);
+
+    // Memoisation Functions
+    lenv_add_builtin(e, "memo", builtin_memo);
+    lenv_add_builtin(e, "memo-stats", builtin_memostats);
+
+    // Typed Array Functions
+    lenv_add_builtin(e, "arr", builtin_arr);
+    lenv_add_builtin(e, "farr", builtin_farr);
+    lenv_add_builtin(e, "arange", builtin_arange);
+    lenv_add_builtin(e, "alist", builtin_alist);
+    lenv_add_builtin(e, "alen", builtin_alen);
+    lenv_add_builtin(e, "aget", builtin_aget);
+    lenv_add_builtin(e, "aadd", builtin_aadd);
+    lenv_add_builtin(e, "asub", builtin_asub);
+    lenv_add_builtin(e, "amul", builtin_amul);
+    lenv_add_builtin(e, "asum", builtin_asum);
+    lenv_add_builtin(e, "amin", builtin_amin);
+    lenv_add_builtin(e, "amax", builtin_amax);
+    lenv_add_builtin(e, "adot", builtin_adot);
+    lenv_add_builtin(e, "alt", builtin_alt);
+    lenv_add_builtin(e, "agt", builtin_agt);
+    lenv_add_builtin(e, "ale", builtin_ale);
+    lenv_add_builtin(e, "age", builtin_age);
+    lenv_add_builtin(e, "aeq", builtin_aeq);
 
     // Control Flow Functions
     lenv_add_builtin(e, "<", builtin_lt);
@@ -176,105 +1048,280 @@ void lenv_add_builtins(lenv *e) {
 
     // Environment functions
     lenv_add_builtin(e, "env", builtin_env);
+    lenv_add_builtin(e, "gc", builtin_gc);
+    lenv_add_builtin(e, "pools", builtin_pools);
     lenv_add_builtin(e, "exit", builtin_exit);
 }
 
 
 
+/* * * * * * * * * *
+*  STRING BUFFERS  *
+* * * * * * * * * */
+// Strings and errors carry their length, so they can hold any bytes, NULs
+// included. Up to LVAL_SSO_MAX of them are kept in the value itself.
+//
+// Longer strings never change once made, but their buffers grow. A buffer is
+// owned by the string it was made for, and strings joined onto it or cut out
+// of it are views sharing it. Joining onto a string that ends where its
+// buffer was last written appends in place, and a buffer that has to be
+// replaced grows to twice the size needed, so building a string by repeated
+// join is linear.
+//
+// Only the last string written to a buffer is sure to be followed by a NUL,
+// so strings are always used together with their length.
+
+static inline char *lval_str_ptr(lval *v) {
+    return (v->gc & GC_INLINE) ? v->sso : v->str;
+}
+
+static inline int lval_str_len(lval *v) {
+    return (v->gc & GC_INLINE) ? v->ssolen : v->slen;
+}
+
+// A String lval holding a copy of the n bytes at s
+lval *lval_str_n(char *s, int n) {
+    if (n > LVAL_SSO_MAX) {
+        lval *v = lval_str_new(n, n);
+        memcpy(v->str, s, n);
+        return v;
+    }
+
+    lval *v = lval_alloc(LVAL_STR);
+    v->gc = GC_INLINE;
+    memcpy(v->sso, s, n);
+    v->sso[n] = '\0';
+    v->ssolen = n;
+    return v;
+}
+
+// A view of n bytes of string v from i on, taking ownership of v. Short
+// ones are copied instead, so they do not keep a large buffer alive
+lval *lval_str_slice(lval *v, int i, int n) {
+    lval *x;
+    if (n <= LVAL_SSO_MAX) {
+        x = lval_str_n(lval_str_ptr(v) + i, n);
+    } else {
+        x = lval_alloc(LVAL_STR);
+        x->str = v->str + i;
+        x->slen = n;
+        x->sbase = lval_copy(v->sbase ? v->sbase : v);
+    }
+    lval_del(v);
+    return x;
+}
+
+// Take ownership of strings x and y and return x followed by y
+lval *lval_str_join(lval *x, lval *y) {
+    int xn = lval_str_len(x);
+    int yn = lval_str_len(y);
+    int n = xn + yn;
+    char *ys = lval_str_ptr(y);
+
+    lval *r;
+    lval *owner = (x->gc & GC_INLINE) ? NULL : x->sbase ? x->sbase : x;
+    lstrbuf *b = owner ? lval_strbuf(owner) : NULL;
+    if (n <= LVAL_SSO_MAX) {
+        r = lval_str_n(lval_str_ptr(x), xn);
+        memcpy(r->sso + xn, ys, yn);
+        r->sso[n] = '\0';
+        r->ssolen = n;
+    } else if (b && x->str + xn == b->data + b->used && b->used + yn <= b->cap) {
+        // y goes straight after x, and x still sees just its own bytes
+        memcpy(b->data + b->used, ys, yn);
+        b->used += yn;
+        b->data[b->used] = '\0';
+        r = lval_alloc(LVAL_STR);
+        r->str = x->str;
+        r->slen = n;
+        r->sbase = lval_copy(owner);
+    } else {
+        r = lval_str_new(n, 2 * n);
+        memcpy(r->str, lval_str_ptr(x), xn);
+        memcpy(r->str + xn, ys, yn);
+        r->str[n] = '\0';
+    }
+
+    lval_del(x);
+    lval_del(y);
+    return r;
+}
+
+// C escapes, as the reader takes them and lval_print_str writes them
+static const char lval_escape_in[] = {
+    '\a', '\b', '\f', '\n', '\r', '\t', '\v', '\\', '\'', '\"', '\0' };
+static const char lval_escape_out[] = {
+    'a', 'b', 'f', 'n', 'r', 't', 'v', '\\', '\'', '\"', '0' };
+
+// Unescape the n bytes at src into dst, which may be src, and return the
+// number of bytes written
+int lval_unescape(char *dst, char *src, int n) {
+    int len = 0;
+    for (int i = 0; i < n; i++) {
+        char *c = i + 1 < n && src[i] == '\\'
+            ? memchr(lval_escape_out, src[i+1], sizeof(lval_escape_out))
+            : NULL;
+        if (c) {
+            dst[len++] = lval_escape_in[c - lval_escape_out];
+            i++;
+        } else {
+            dst[len++] = src[i];
+        }
+    }
+    return len;
+}
+
+
+
 /* * * * * * * * * * * * * * * *
 *  LVAL CONSTRUCTOR FUNCTIONS *
 * * * * * * * * * * * * * * * */
+// Allocate a heap lval in the nursery, holding the only reference to it
+lval *lval_alloc(int type) {
+    lval *v = gc_alloc();
+    v->type = type;
+    v->gc = 0;
+    return v;
+}
+
+// A String lval of n bytes, not yet filled in, in a new buffer with room
+// for cap bytes
+lval *lval_str_new(int n, int cap) {
+    lstrbuf *b = malloc(sizeof(lstrbuf) + cap + 1);
+    b->cap = cap;
+    b->used = n;
+    b->data[n] = '\0';
+
+    lval *v = lval_alloc(LVAL_STR);
+    v->str = b->data;
+    v->slen = n;
+    v->sbase = NULL;
+    return v;
+}
+
 // Construct a pointer to a new String lval
 lval *lval_str(char *s){
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_STR;
-    v->str = malloc(strlen(s) + 1);
-    strcpy(v->str, s);
-    return v;
+    return lval_str_n(s, strlen(s));
 }
 
-// Construct a pointer to a new Boolean lval
+// Booleans are always immediate
 lval *lval_bool(bool truth) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_BOOL;
-    v->truth_value = truth;
-    return v;
+    return truth ? lval_true : lval_false;
 }
 
 // Construct a pointer to a new Function lval
 lval *lval_fun(lbuiltin func) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
+    lval *v = lval_alloc(LVAL_FUN);
     v->builtin = func;
     return v;
 }
 
 // Construct a pointer to a new Lambda func lval
+// env only holds arguments bound by partial application, so starts out empty
 lval *lval_lambda(lval *formals, lval *body) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
+    lval *v = lval_alloc(LVAL_FUN);
     v->builtin = NULL;
-    v->env = lenv_new();
+    v->env = NULL;
     v->formals = formals;
     v->body = body;
     return v;
 }
 
-// Construct a pointer to a new Number lval
+// Construct a Number lval, only boxing it if it does not fit in a fixnum
 lval *lval_num(long x) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_NUM;
+    if (x >= LVAL_FIXNUM_MIN && x <= LVAL_FIXNUM_MAX) {
+        return (lval*)(((uintptr_t)x << 1) | 1);
+    }
+    lval *v = lval_alloc(LVAL_NUM);
     v->num = x;
     return v;
 }
 
 // Construct a pointer to a new Error lval
 lval *lval_err(char *fmt, ...) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_ERR;
-
     // Create a va_list and initialize it
     va_list va;
     va_start(va, fmt);
 
-    v->err = malloc(512);
-
     // printf the error string with a maximum of 511 characters
-    vsnprintf(v->err, 511, fmt, va);
-
-    // reallocate to number of bites actually used
-    v->err = realloc(v->err, strlen(v->err)+1);
+    char buf[512];
+    vsnprintf(buf, sizeof(buf), fmt, va);
 
     // clean up our va list
     va_end(va);
 
+    // Errors are stored just like strings
+    lval *v = lval_str(buf);
+    v->type = LVAL_ERR;
     return v;
 }
 
-// Construct a pointer to a new Symbol lval
+// Symbols are immediates pointing at their interned name
 lval *lval_sym(char *s) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_SYM;
-    v->sym = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
+    return (lval*)((intptr_t)lsym_intern(s) | 4);
+}
+
+// Construct a pointer to a new Symbol lval bound to a known frame slot
+lval *lval_slot_sym(char *sym, int slot) {
+    lval *v = lval_alloc(LVAL_SYM);
+    v->sym = sym;
+    v->slot = slot;
     return v;
 }
 
 // A pointer to a new empty Sexpr lval
 lval *lval_sexpr(void) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_SEXPR;
+    lval *v = lval_alloc(LVAL_SEXPR);
     v->count = 0;
     v->cell = NULL;
+    v->code = NULL;
+    v->base = NULL;
     return v;
 }
 
 // A pointer to a new empty Qexpr lval
 lval *lval_qexpr(void) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_QEXPR;
+    lval *v = lval_alloc(LVAL_QEXPR);
     v->count = 0;
     v->cell = NULL;
+    v->code = NULL;
+    v->base = NULL;
+    return v;
+}
+
+// A pointer to a new empty Vector lval with room for cap items
+lval *lval_vec(int cap) {
+    lval *v = lval_alloc(LVAL_VEC);
+    v->len = 0;
+    v->cap = cap;
+    v->items = pool_array_alloc(cap);
+    return v;
+}
+
+// Construct a pointer to a new Float lval
+lval *lval_flt(double x) {
+    lval *v = lval_alloc(LVAL_FLT);
+    v->dbl = x;
+    return v;
+}
+
+// A pointer to a new Array lval of n elements, not yet filled in
+lval *lval_arr(int kind, int n) {
+    lval *v = lval_alloc(LVAL_ARR);
+    v->alen = n;
+    v->akind = kind;
+    v->adata = malloc(8 * (n ? n : 1));
+    return v;
+}
+
+// A pointer to a new empty Map lval with a power of two number of slots
+lval *lval_map(int slots) {
+    lval *v = lval_alloc(LVAL_MAP);
+    v->size = 0;
+    v->filled = 0;
+    v->mask = slots - 1;
+    v->table = pool_array_alloc(2 * slots);
+    memset(v->table, 0, sizeof(lval*) * 2 * slots);
     return v;
 }
 
@@ -285,69 +1332,157 @@ lval *lval_qexpr(void) {
 * LVAL HELPER FUNCTIONS *
 * * * * * * * * * * * * */
 
+/* * * * * *
+*  SHARING  *
+* * * * * */
+// Heap values are immutable once a second reference to them has been taken,
+// so a copy is just another reference. Anything that wants to change a value
+// in place calls lval_mut() first, which hands back the value itself if it
+// was never shared and a private shallow copy otherwise. lval_del gives back
+// a value nobody else can see straight away; shared values are left to the
+// collector.
+
 lval *lval_copy(lval *v) {
+    // Immediates carry their whole value in the pointer
+    if (lval_is_immediate(v)) { return v; }
+    v->gc |= GC_SHARED;
+    return v;
+}
 
-    lval *x = malloc(sizeof(lval));
-    x->type = v->type;
+// A new value with the same contents as v, sharing its children
+lval *lval_dup(lval *v) {
+    lval *x = lval_alloc(v->type);
 
     switch (v->type) {
         // Copy Functions and Numbers Directly
         case LVAL_FUN:
             if (v->builtin) {
                 x->builtin = v->builtin;
+                // A memoised function shares its cache with its copies
+                if (v->builtin == builtin_memoised) {
+                    x->formals = lval_copy(v->formals);
+                    x->body = lval_copy(v->body);
+                }
             } else {
                 x->builtin = NULL;
-                x->env = lenv_copy(v->env);
+                x->env = v->env ? lenv_copy(v->env) : NULL;
                 x->formals = lval_copy(v->formals);
                 x->body = lval_copy(v->body);
             }
             break;
         case LVAL_NUM: x->num = v->num; break;
-        case LVAL_BOOL:
-            x->truth_value = v->truth_value; break;
+        case LVAL_SYM: x->sym = v->sym; x->slot = v->slot; break;
+        case LVAL_BIG:
+            x->bsign = v->bsign;
+            x->blen = v->blen;
+            x->limbs = malloc(sizeof(uint32_t) * v->blen);
+            memcpy(x->limbs, v->limbs, sizeof(uint32_t) * v->blen);
+            break;
+        case LVAL_FLT: x->dbl = v->dbl; break;
+        case LVAL_ARR:
+            x->alen = v->alen;
+            x->akind = v->akind;
+            x->adata = malloc(8 * (x->alen ? x->alen : 1));
+            memcpy(x->adata, v->adata, 8 * x->alen);
+            break;
 
-        // Copy Strings using malloc and strcpy
+        // Strings never change in place, so share the buffer
         case LVAL_STR:
-            x->str = malloc(strlen(v->str) + 1);
-            strcpy(x->str, v->str); break;
         case LVAL_ERR:
-            x->err = malloc(strlen(v->err) + 1);
-            strcpy(x->err, v->err); break;
-        case LVAL_SYM:
-            x->sym = malloc(strlen(v->sym) + 1);
-            strcpy(x->sym, v->sym); break;
+            if (v->gc & GC_INLINE) {
+                x->gc |= GC_INLINE;
+                memcpy(x->sso, v->sso, sizeof(x->sso));
+                x->ssolen = v->ssolen;
+            } else {
+                x->str = v->str;
+                x->slen = v->slen;
+                x->gc |= v->gc & GC_HASHED;
+                x->shash = v->shash;
+                x->sbase = lval_copy(v->sbase ? v->sbase : v);
+            }
+            break;
 
-        // Copy lists by copying each sub-expression
+        // Copy lists by sharing each sub-expression
         case LVAL_SEXPR:
         case LVAL_QEXPR:
             x->count = v->count;
-            x->cell =  malloc(sizeof(lval*) * x->count);
+            x->cell = pool_array_alloc(x->count);
+            x->code = NULL;
+            x->base = NULL;
             for (int i = 0; i < x->count; i++) {
                 x->cell[i] = lval_copy(v->cell[i]);
             }
         break;
-    }
 
-    return x;
-}
+        case LVAL_VEC:
+            x->len = x->cap = v->len;
+            x->items = pool_array_alloc(x->cap);
+            for (int i = 0; i < x->len; i++) {
+                x->items[i] = lval_copy(v->items[i]);
+            }
+        break;
+
+        case LVAL_MAP:
+            x->size = v->size;
+            x->filled = v->filled;
+            x->mask = v->mask;
+            x->table = pool_array_alloc(2 * (x->mask + 1));
+            for (int i = 0; i < 2 * (x->mask + 1); i++) {
+                x->table[i] = v->table[i] ? lval_copy(v->table[i]) : NULL;
+            }
+        break;
+
+        // A cache is free to forget, so a copy starts empty
+        case LVAL_MEMO: x->memo = lmemo_new(v->memo->cap); break;
+    }
+
+    return x;
+}
+
+// Take ownership of v and return a value that is safe to modify in place
+lval *lval_mut(lval *v) {
+    if (lval_is_immediate(v) || !(v->gc & GC_SHARED)) { return v; }
+    return lval_dup(v);
+}
 
 void lval_del(lval *v) {
+    if (lval_is_immediate(v)) { return; }
+
+    // Someone else may still hold a shared value
+    if (v->gc & (GC_SHARED | GC_FREED)) { return; }
+
     switch (v->type) {
         case LVAL_FUN:
         if (!v->builtin) {
-            lenv_del(v->env);
+            if (v->env) { lenv_del(v->env); }
+            lval_del(v->formals);
+            lval_del(v->body);
+        } else if (v->builtin == builtin_memoised) {
             lval_del(v->formals);
             lval_del(v->body);
         }
         break;
-        // Do nothing special for number type
+        // Do nothing special for boxed numbers and slot symbols
         case LVAL_NUM: break;
-        case LVAL_BOOL: break;
+        case LVAL_SYM: break;
+        case LVAL_BIG: free(v->limbs); break;
+        case LVAL_FLT: break;
+        case LVAL_ARR: free(v->adata); break;
+
+        // Let go of every remembered call
+        case LVAL_MEMO:
+            for (int i = 0; i < v->memo->count; i++) {
+                lval_del(v->memo->entries[i].args);
+                lval_del(v->memo->entries[i].val);
+            }
+            lmemo_del(v->memo);
+            break;
 
-        // For Str, Err or Sym free the string data
-        case LVAL_ERR: free(v->err); break;
-        case LVAL_SYM: free(v->sym); break;
-        case LVAL_STR: free(v->str); break;
+        // For Str or Err free the buffer, unless it is inline or shared
+        case LVAL_ERR:
+        case LVAL_STR:
+            if (!(v->gc & GC_INLINE) && !v->sbase) { free(lval_strbuf(v)); }
+            break;
 
         // If Qexpr or Sexpr then deleet all elements inside
         case LVAL_QEXPR:
@@ -356,70 +1491,175 @@ void lval_del(lval *v) {
             lval_del(v->cell[i]);
         }
         // Also free the memory allocated to contain the pointers
-        free(v->cell);
+        pool_array_free(v->cell, v->count);
+        if (v->code) { lcode_del(v->code); }
+        break;
+
+        case LVAL_VEC:
+        for (int i = 0; i < v->len; i++) {
+            lval_del(v->items[i]);
+        }
+        pool_array_free(v->items, v->cap);
+        break;
+
+        // Empty slots and tombstones are skipped
+        case LVAL_MAP:
+        for (int i = 0; i < 2 * (v->mask + 1); i++) {
+            if (v->table[i]) { lval_del(v->table[i]); }
+        }
+        pool_array_free(v->table, 2 * (v->mask + 1));
+        break;
     }
 
-    // Free the memory allocated for the 'lval' struct itself
-    free(v);
+    // The struct itself belongs to the collector
+    v->gc |= GC_FREED;
 }
 
-int lval_eq(lval *x, lval *y) {
-    // Different Types are always unequal
-    if (x->type != y->type) { return 0; }
+static inline int lval_is_number(lval *v) {
+    int t = lval_type(v);
+    return t == LVAL_NUM || t == LVAL_BIG || t == LVAL_FLT;
+}
+
+// Equality, where exact also tells apart numbers of different types
+static int lval_eq_by(lval *x, lval *y, int exact) {
+    // Identical pointers are equal, which settles fixnums and booleans
+    if (x == y) { return 1; }
+
+    // Numbers of different types are equal if their values are, otherwise
+    // different Types are always unequal
+    int t = lval_type(x);
+    if (t != lval_type(y)) {
+        if (exact || !lval_is_number(x) || !lval_is_number(y)) { return 0; }
+        if (t == LVAL_FLT && x->dbl != x->dbl) { return 0; }
+        if (lval_type(y) == LVAL_FLT && y->dbl != y->dbl) { return 0; }
+        return lval_num_cmp(x, y) == 0;
+    }
 
     // Compare based upon type
-    switch (x->type) {
-        // Compare number value
-        case LVAL_NUM: return (x->num == y->num);
-        case LVAL_BOOL: return (x->truth_value == y->truth_value);
+    switch (t) {
+        // Fixnums were settled above, boxed numbers are never fixnums
+        case LVAL_NUM: return (lval_to_num(x) == lval_to_num(y));
+        case LVAL_BIG: return lval_num_cmp(x, y) == 0;
+        case LVAL_FLT: return x->dbl == y->dbl;
+
+        // Same kind and length, with equal elements
+        case LVAL_ARR:
+            if (x->akind != y->akind || x->alen != y->alen) { return 0; }
+            for (int i = 0; i < x->alen; i++) {
+                if (x->akind == ARR_I64
+                    ? ((int64_t*)x->adata)[i] != ((int64_t*)y->adata)[i]
+                    : ((double*)x->adata)[i] != ((double*)y->adata)[i]) {
+                    return 0;
+                }
+            }
+            return 1;
+
+        // Interned names are equal only if they are the same pointer
+        case LVAL_SYM: return (lval_to_sym(x) == lval_to_sym(y));
 
-        // Compare string values
-        case LVAL_STR: return (strcmp(x->str, y->str) == 0);
-        case LVAL_ERR: return (strcmp(x->err, y->err) == 0);
-        case LVAL_SYM: return (strcmp(x->sym, y->sym) == 0);
+        // Compare string values, shared long strings by hash first
+        case LVAL_STR:
+        case LVAL_ERR:
+            if (lval_str_len(x) != lval_str_len(y)) { return 0; }
+            if (t == LVAL_STR && (x->gc & y->gc & GC_SHARED)
+                && !((x->gc | y->gc) & GC_INLINE)
+                && lval_hash(x) != lval_hash(y)) {
+                return 0;
+            }
+            return memcmp(lval_str_ptr(x), lval_str_ptr(y), lval_str_len(x)) == 0;
 
         // If builtin, compare, otherwasie compare formals and body
         case LVAL_FUN:
+            // Memoised functions are only equal if they share a cache
+            if (x->builtin == builtin_memoised || y->builtin == builtin_memoised) {
+                return x->builtin == y->builtin && x->body == y->body;
+            }
             if (x->builtin || y->builtin) {
                 return x->builtin == y->builtin;
             } else {
-                return lval_eq(x->formals, y->formals)
-                    && lval_eq(x->body, y->body);
+                return lval_eq_by(x->formals, y->formals, exact)
+                    && lval_eq_by(x->body, y->body, exact);
             }
 
-        // If list, compare every individual element
+        // If list, compare every individual element. Shared lists can no
+        // longer change, so their hashes are worth working out and keeping
         case LVAL_QEXPR:
         case LVAL_SEXPR:
             if (x->count != y->count) { return 0; }
+            if (x->count && (x->gc & y->gc & GC_SHARED)
+                && lval_hash(x) != lval_hash(y)) {
+                return 0;
+            }
             for (int i = 0; i < x->count; i++) {
                 // If any element not equal then whole list not equal
-                if ( !lval_eq(x->cell[i], y->cell[i]) ) { return 0; }
+                if ( !lval_eq_by(x->cell[i], y->cell[i], exact) ) { return 0; }
             }
             // Otherwise, lists must be equal
             return 1;
         break;
+
+        case LVAL_VEC:
+            if (x->len != y->len) { return 0; }
+            for (int i = 0; i < x->len; i++) {
+                if ( !lval_eq_by(x->items[i], y->items[i], exact) ) { return 0; }
+            }
+            return 1;
+
+        // Same keys, each with an equal value
+        case LVAL_MAP:
+            if (x->size != y->size) { return 0; }
+            for (int i = 0; i <= x->mask; i++) {
+                lval *k = x->table[2*i];
+                if (!k || k == lval_tomb) { continue; }
+                int j = lval_map_find(y, k, lval_hash(k));
+                if (j < 0 || !lval_eq_by(x->table[2*i+1], y->table[2*j+1], exact)) {
+                    return 0;
+                }
+            }
+            return 1;
     }
     return 0;
 }
 
+int lval_eq(lval *x, lval *y) { return lval_eq_by(x, y, 0); }
+
+// Equal and of the same types all the way down, for caches that must not
+// hand back a result worked out from a Number for a Float
+int lval_same(lval *x, lval *y) { return lval_eq_by(x, y, 1); }
+
 /* print an 'lval' */
 void lval_print(lval *v) {
-    switch (v->type) {
+    switch (lval_type(v)) {
         case LVAL_FUN:
-            if (v->builtin) {
+            if (v->builtin == builtin_memoised) {
+                printf("(memo "); lval_print(v->formals); putchar(')');
+            } else if (v->builtin) {
                 printf("<builtin>");
             } else {
                 printf("(\\ "); lval_print(v->formals);
                 putchar(' '); lval_print(v->body); putchar(')');
             }
             break;
-        case LVAL_NUM: printf("%li", v->num); break;
+        case LVAL_NUM: printf("%li", lval_to_num(v)); break;
+        case LVAL_BIG: {
+            char *digits = lval_big_str(v);
+            fputs(digits, stdout);
+            free(digits);
+            break;
+        }
+        case LVAL_FLT: lval_flt_print(v->dbl); break;
         case LVAL_STR: lval_print_str(v); break;
-        case LVAL_BOOL: printf("Boolean: %d", v->truth_value); break;
-        case LVAL_ERR: printf("Error: %s", v->err); break;
-        case LVAL_SYM: printf("%s", v->sym); break;
+        case LVAL_BOOL: printf("Boolean: %d", lval_truth(v)); break;
+        case LVAL_ERR:
+            printf("Error: ");
+            fwrite(lval_str_ptr(v), 1, lval_str_len(v), stdout);
+            break;
+        case LVAL_SYM: printf("%s", lval_to_sym(v)); break;
         case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
         case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
+        case LVAL_VEC: lval_vec_print(v); break;
+        case LVAL_MAP: lval_map_print(v); break;
+        case LVAL_ARR: lval_arr_print(v); break;
         break;
     }
 }
@@ -439,47 +1679,155 @@ void lval_expr_print(lval *v, char open, char close) {
     putchar(close);
 }
 
+void lval_vec_print(lval *v) {
+    putchar('[');
+    for (int i = 0; i < v->len; i++) {
+        lval_print(v->items[i]);
+        if (i != v->len - 1) { putchar(' '); }
+    }
+    putchar(']');
+}
+
+void lval_map_print(lval *v) {
+    printf("#{");
+    int first = 1;
+    for (int i = 0; i <= v->mask; i++) {
+        lval *k = v->table[2*i];
+        if (!k || k == lval_tomb) { continue; }
+        if (!first) { putchar(' '); }
+        putchar('{'); lval_print(k); putchar(' ');
+        lval_print(v->table[2*i+1]); putchar('}');
+        first = 0;
+    }
+    putchar('}');
+}
+
+// The fewest digits, from 15 up, that read back the same, always with a point
+void lval_flt_print(double x) {
+    char buf[32];
+    for (int p = 15; p <= 17; p++) {
+        snprintf(buf, sizeof(buf), "%.*g", p, x);
+        if (strtod(buf, NULL) == x) { break; }
+    }
+    if (!strpbrk(buf, ".ein")) { strcat(buf, ".0"); }
+    fputs(buf, stdout);
+}
+
+void lval_arr_print(lval *v) {
+    printf(v->akind == ARR_I64 ? "#i64[" : "#f64[");
+    for (int i = 0; i < v->alen; i++) {
+        if (v->akind == ARR_I64) {
+            printf("%lli", (long long)((int64_t*)v->adata)[i]);
+        } else {
+            lval_flt_print(((double*)v->adata)[i]);
+        }
+        if (i != v->alen - 1) { putchar(' '); }
+    }
+    putchar(']');
+}
+
 void lval_print_str(lval *v) {
-    // Make a Copy of the string
-    char *escaped = malloc(strlen(v->str)+1);
-    strcpy(escaped, v->str);
-    // Pass it through the escape function
-    escaped = mpcf_escape(escaped);
-    // Print it between " characters
-    printf("\"%s\"", escaped);
-    // free copied string
-    free(escaped);
+    char *s = lval_str_ptr(v);
+    int n = lval_str_len(v);
+
+    // Print it between " characters, escaping as we go
+    putchar('"');
+    for (int i = 0; i < n; i++) {
+        char *c = memchr(lval_escape_in, s[i], sizeof(lval_escape_in));
+        if (c) {
+            putchar('\\');
+            putchar(lval_escape_out[c - lval_escape_in]);
+        } else {
+            putchar(s[i]);
+        }
+    }
+    putchar('"');
 }
 
 /* print an 'lval' followed by a newline */
 void lval_println(lval *v) { lval_print(v); putchar('\n'); }
 
-lval *lval_read_num(mpc_ast_t *t) {
+lval *lval_read_num(char *s) {
+    if (strpbrk(s, ".eE")) { return lval_flt(strtod(s, NULL)); }
     errno = 0;
-    long x = strtol(t->contents, NULL, 10);
+    long x = strtol(s, NULL, 10);
     return errno != ERANGE ?
-    lval_num(x) : lval_err("invalid number");
+    lval_num(x) : lval_big_read(s);
 }
 
 lval *lval_read_str(mpc_ast_t *t) {
-    // Cut off the final quote qcharacter
-    t->contents[strlen(t->contents)-1] = '\0';
-    // Copy the string missing out the first quote character
-    char *unescaped = malloc(strlen(t->contents+1)+1);
-    strcpy(unescaped, t->contents+1);
-    // Pass through the unescape function
-    unescaped = mpcf_unescape(unescaped);
-    // Construct a new lval using the string
-    lval *str = lval_str(unescaped);
-    // Free the string and return
-    free(unescaped);
-    return str;
+    // Unescape what is between the quotes in place, it only gets shorter
+    char *s = t->contents + 1;
+    int n = lval_unescape(s, s, strlen(s) - 1);
+    return lval_str_n(s, n);
+}
+
+// Hash-consing: equal literal Q-Expressions within one read become a single
+// shared value. Reading never collects and nothing runs until it is done,
+// so the table can hold plain pointers and is forgotten after every read.
+//
+// Only flat lists take part, such as formals, {} and lists of symbols. Ones
+// with lists inside are bodies or data, which seldom repeat, and a large data
+// file stops adding to the table after LVAL_CONS_MAX of them.
+typedef struct {
+    unsigned long hash;
+    lval *v;
+} lconst;
+
+static lconst *lval_consts;
+static int lval_consts_mask = -1;
+static int lval_consts_count;
+
+// Take ownership of Q-Expression x and return it, or an equal one read before
+lval *lval_read_cons(lval *x) {
+    for (int i = 0; i < x->count; i++) {
+        int t = lval_type(x->cell[i]);
+        if (t == LVAL_QEXPR || t == LVAL_SEXPR) { return x; }
+    }
+
+    // Keep the table at most half full
+    if (lval_consts_count < LVAL_CONS_MAX
+        && 2 * (lval_consts_count + 1) > lval_consts_mask + 1) {
+        int slots = lval_consts_mask < 0 ? 64 : 2 * (lval_consts_mask + 1);
+        lconst *old = lval_consts;
+        int old_slots = lval_consts_mask + 1;
+        lval_consts = calloc(slots, sizeof(lconst));
+        lval_consts_mask = slots - 1;
+        for (int i = 0; i < old_slots; i++) {
+            if (!old[i].v) { continue; }
+            int j = old[i].hash & lval_consts_mask;
+            while (lval_consts[j].v) { j = (j + 1) & lval_consts_mask; }
+            lval_consts[j] = old[i];
+        }
+        free(old);
+    }
+
+    unsigned long h = lval_hash(x);
+    int i = h & lval_consts_mask;
+    for (; lval_consts[i].v; i = (i + 1) & lval_consts_mask) {
+        if (lval_consts[i].hash == h && lval_same(lval_consts[i].v, x)) {
+            lval_del(x);
+            return lval_copy(lval_consts[i].v);
+        }
+    }
+    if (lval_consts_count < LVAL_CONS_MAX) {
+        lval_consts[i].hash = h;
+        lval_consts[i].v = x;
+        lval_consts_count++;
+    }
+    return x;
+}
+
+void lval_read_cons_reset(void) {
+    if (!lval_consts_count) { return; }
+    memset(lval_consts, 0, sizeof(lconst) * (lval_consts_mask + 1));
+    lval_consts_count = 0;
 }
 
 lval *lval_read(mpc_ast_t *t) {
 
     // If Symbol or Number return conversion to that type
-    if (strstr(t->tag, "number")) { return lval_read_num(t); }
+    if (strstr(t->tag, "number")) { return lval_read_num(t->contents); }
     if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
 
     // if root (>) or sexpr then create empty list
@@ -501,31 +1849,37 @@ lval *lval_read(mpc_ast_t *t) {
         x = lval_add(x, lval_read(t->children[i]));
     }
 
+    if (lval_type(x) == LVAL_QEXPR) { return lval_read_cons(x); }
+    if (strcmp(t->tag, ">") == 0) { lval_read_cons_reset(); }
     return x;
 }
 
 lval *lval_add(lval *v, lval *x) {
+    v = lval_mut(v);
+    v->cell = pool_array_resize(v->cell, v->count, v->count + 1);
     v->count++;
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
     v->cell[v->count-1] = x;
+    gc_write(v);
     return v;
 }
 
 lval *lval_join(lval *x , lval *y) {
     // If they're both strings
-    if (x->type == LVAL_STR && y->type == LVAL_STR) {
-        x->str = realloc(x->str, sizeof(x->str) + sizeof(y->str) + 1);
-        strcat(x->str, y->str);
-        lval_del(y);
-        return x;
+    if (lval_type(x) == LVAL_STR && lval_type(y) == LVAL_STR) {
+        return lval_str_join(x, y);
     }
 
-    // For each cell in 'y' add it to 'x'
-    while (y->count) {
-        x = lval_add(x, lval_pop(y, 0));
+    x = lval_mut(x);
+
+    // Append every cell of 'y' to 'x' in one go
+    x->cell = pool_array_resize(x->cell, x->count, x->count + y->count);
+    for (int i = 0; i < y->count; i++) {
+        x->cell[x->count + i] = lval_copy(y->cell[i]);
     }
+    x->count += y->count;
+    gc_write(x);
 
-    // Delete the empty 'y' and return 'x'
+    // Delete 'y' and return 'x'
     lval_del(y);
     return x;
 }
@@ -541,26 +1895,81 @@ lval *lval_pop(lval *v, int i) {
     v->count--;
 
     //reallocate the memory used
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+    v->cell = pool_array_resize(v->cell, v->count + 1, v->count);
+    return x;
+}
+
+// Take ownership of list v and return its n elements from i on. The result
+// is a view sharing v's storage, so both are immutable from now on
+lval *lval_slice(lval *v, int i, int n) {
+    if (i == 0 && n == v->count) { return v; }
+
+    // Nothing to share, and no reason to keep v alive
+    if (n == 0) {
+        lval *x = lval_alloc(v->type);
+        x->count = 0;
+        x->cell = NULL;
+        x->code = NULL;
+        x->base = NULL;
+        lval_del(v);
+        return x;
+    }
+
+    lval *x = lval_alloc(v->type);
+    x->gc = GC_SHARED;
+    x->count = n;
+    x->cell = v->cell + i;
+    x->code = NULL;
+
+    // Views always point at the list that owns the storage
+    if (v->base) {
+        x->base = lval_copy(v->base);
+        lval_del(v);
+    } else {
+        x->base = lval_copy(v);
+    }
     return x;
 }
 
 lval *lval_take(lval *v, int i) {
+    // Leave a shared list alone and just take another reference
+    if (v->gc & GC_SHARED) {
+        lval *x = lval_copy(v->cell[i]);
+        lval_del(v);
+        return x;
+    }
+
     lval *x = lval_pop(v, i);
     lval_del(v);
     return x;
 }
 
+// Set just before evaluating the S-Expression in tail position of a body
+// run by the tree-walker, see lval_walk
+int walk_tail = 0;
+lval walk_pending;
+lval *walk_pending_f = NULL;
+lval *walk_pending_a = NULL;
+
 lval *lval_eval_sexpr(lenv *e, lval *v) {
+    int tail = walk_tail;
+    walk_tail = 0;
 
-    // Evaluate children
+    // Children are evaluated in place, so v has to be ours
+    v = lval_mut(v);
+
+    // Evaluate children, v may be moved by a collection meanwhile
+    gc_root(&v);
     for (int i = 0; i < v->count; i++) {
-        v->cell[i] = lval_eval(e, v->cell[i]);
+        lval *x = lval_eval(e, v->cell[i]);
+        v->cell[i] = x;
+        gc_write(v);
     }
+    gc_unroot(1);
 
     // Error Checking
     for (int i = 0; i  < v->count; i++) {
-        if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+        if (lval_type(v->cell[i]) == LVAL_ERR) { return lval_take(v, i); }
     }
 
     // Empty Expression
@@ -571,22 +1980,44 @@ lval *lval_eval_sexpr(lenv *e, lval *v) {
 
     // Ensure First Element is a function after evaluation
     lval *f = lval_pop(v, 0);
-    if (f->type != LVAL_FUN) {
+    if (lval_type(f) != LVAL_FUN) {
         lval *err = lval_err(
             "S-Expression starts with incorrect type. "
             "Got %s, Expected %s.",
-            ltype_name(f->type), ltype_name(LVAL_FUN));
+            ltype_name(lval_type(f)), ltype_name(LVAL_FUN));
             lval_del(f); lval_del(v);
             return err;
         }
 
+        // A lambda in tail position is left for lval_walk to call, and the
+        // branch 'if' picks is in tail position as well
+        if (tail && !f->builtin) {
+            walk_pending_f = f;
+            walk_pending_a = v;
+            return &walk_pending;
+        }
+        if (tail && f->builtin == builtin_if) {
+            walk_tail = 1;
+            lval *x = lval_call(e, f, v);
+            walk_tail = 0;
+            return x;
+        }
+
         // If so call function to get result
-        lval *result = lval_call(e, f, v);
-        lval_del(f);
-        return result;
+        return lval_call(e, f, v);
 }
 
 lval *lval_eval(lenv *e, lval *v) {
+    // Safepoint: the only place a collection happens
+    if (gc_pending) {
+        gc_root(&v);
+        gc_collect();
+        gc_unroot(1);
+    }
+
+    if (lval_is_sym(v)) { return lenv_get(e, v); }
+    if (lval_is_immediate(v)) { return v; }
+
     if (v->type == LVAL_SYM) {
         lval *x = lenv_get(e, v);
         lval_del(v);
@@ -597,438 +2028,3100 @@ lval *lval_eval(lenv *e, lval *v) {
     return v;
 }
 
-lval *lval_call(lenv *e, lval *f, lval *a) {
-    // If Builtin then simply call that
-    if (f->builtin) { return f->builtin(e,a); }
+// Bind the arguments a to the formals of lambda f in an empty frame, after
+// any arguments bound by an earlier partial application. Takes ownership of
+// a but not f. Returns NULL once every formal is bound, and otherwise an
+// error or a new partially applied function.
+lval *lval_bind(lenv *frame, lval *f, lval *a) {
+    if (f->env) {
+        for (int i = 0; i < f->env->count; i++) {
+            lenv_put_sym(frame, f->env->syms[i], f->env->vals[i]);
+        }
+    }
+
+    lval *formals = f->formals;
+    lval *err = NULL;
 
     // Record Argument Counts
     int given = a->count;
-    int total = f->formals->count;
+    int total = formals->count;
 
-    // While arguments still remain to be processed
-    while (a->count) {
+    // Bind each argument to the next formal
+    int next = 0;
+    for (int i = 0; i < a->count; i++) {
 
         // If we've run out of formal arguments to bind
-        if (f->formals->count == 0) {
-            lval_del(a); return lval_err(
+        if (next == formals->count) {
+            err = lval_err(
                 "Function passet too many arguments. "
                 "Got %i, Expected %i.", given, total);
+            break;
         }
 
-        // Pop the first symbol from the formals
-        lval *sym = lval_pop(f->formals, 0);
+        char *sym = lval_to_sym(formals->cell[next++]);
 
-        if (strcmp(sym->sym, "&") == 0) {
+        if (sym == lsym_amp) {
             // Ensure '&' is followed by another symbol
-            if (f->formals->count != 1) {
-                lval_del(a);
-                return lval_err("Function format invalid. "
+            if (next != formals->count - 1) {
+                err = lval_err("Function format invalid. "
                 "Symbol '&' not followed by single symbol.");
+                break;
             }
 
             // Next formal should be bound to remaining arguments
-            lval *nsym = lval_pop(f->formals, 0);
-            lenv_put(f->env, nsym, builtin_list(e, a));
-            lval_del(sym); lval_del(nsym);
+            lval *rest = lval_qexpr();
+            for (; i < a->count; i++) { rest = lval_add(rest, lval_copy(a->cell[i])); }
+            lenv_put_sym(frame, lval_to_sym(formals->cell[next++]), rest);
             break;
         }
 
-        // Pop the next argument from the list
-        lval *val = lval_pop(a, 0);
-
-        // Bind a copy into the function's environment
-        lenv_put(f->env, sym, val);
-
-        // Delete symbol and values
-        lval_del(sym); lval_del(val);
+        // Bind it into the frame
+        lenv_put_sym(frame, sym, a->cell[i]);
     }
 
     // Arguments list is now bound so can be cleaned up
     lval_del(a);
+    if (err) { return err; }
 
     // If '&' remains in formal list bind to empty list
-    if (f->formals->count > 0 && strcmp(f->formals->cell[0]->sym, "&") == 0) {
+    if (next < formals->count && lval_to_sym(formals->cell[next]) == lsym_amp) {
         // Check to ensure that & is not passed invalidly.
-        if (f->formals->count != 2) {
+        if (formals->count - next != 2) {
             return lval_err("Function format invalid. "
             "Symbol '&' not followed by single symbol.");
         }
+        lenv_put_sym(frame, lval_to_sym(formals->cell[next + 1]), lval_qexpr());
+        next += 2;
+    }
 
-        // Pop and delete '&' symbol
-        lval_del(lval_pop(f->formals, 0));
+    if (next == formals->count) { return NULL; }
+
+    // Otherwise return a new partially applied function, keeping what has
+    // been bound so far
+    lval *p = lval_alloc(LVAL_FUN);
+    p->builtin = NULL;
+    p->env = lenv_copy(frame);
+    p->env->par = NULL;
+    p->formals = lval_qexpr();
+    for (int i = next; i < formals->count; i++) {
+        p->formals = lval_add(p->formals, lval_copy(formals->cell[i]));
+    }
+    p->body = lval_copy(f->body);
+    return p;
+}
 
-        // Pop next symbol and create empty List
-        lval *sym = lval_pop(f->formals, 0);
-        lval *val = lval_qexpr();
+// The tree-walker's loop for a lambda body in frame e. A lambda called from
+// tail position comes back as walk_pending instead of being called, and its
+// frame replaces e here, so tail calls need no C stack.
+lval *lval_walk(lenv *e, lval *body) {
+    for (;;) {
+        body = lval_mut(body);
+        body->type = LVAL_SEXPR;
+        walk_tail = 1;
+        lval *x = lval_eval(e, body);
+        if (x != &walk_pending) { return x; }
+
+        lval *f = walk_pending_f;
+        lenv next;
+        lenv_frame(&next, e);
+        x = lval_bind(&next, f, walk_pending_a);
+        if (x) {
+            lval_del(f);
+            lenv_del(&next);
+            return x;
+        }
 
-        // Bind to environment and delete
-        lenv_put(f->env, sym, val);
-        lval_del(sym); lval_del(val);
+        body = lval_copy(f->body);
+        lval_del(f);
+        lenv_replace(e, &next);
     }
+}
+
+// Evaluate a lambda body in a bound frame, taking ownership of the body
+lval *lval_run(lenv *frame, lval *body) {
+    gc_root_env(frame);
+    lval *result = vm_enabled ? vm_run(frame, body) : lval_walk(frame, body);
+    gc_unroot_env();
+    return result;
+}
+
+// Calls f with the arguments a, taking ownership of both
+// A lambda is never changed by calling it. Each call binds its arguments into
+// a fresh activation frame on the C stack, so a call costs only as much as
+// its arity.
+lval *lval_call(lenv *e, lval *f, lval *a) {
+    if (f->builtin == builtin_memoised) { return lval_memo_call(e, f, a); }
 
-    // If all formals have been bound, evaluate
-    if (f->formals->count == 0) {
+    // If Builtin then simply call that
+    if (f->builtin) {
+        lbuiltin builtin = f->builtin;
+        lval_del(f);
+        return builtin(e, a);
+    }
 
-        // Set environment parent to evaluation Environment
-        f->env->par = e;
+    // Dynamic scope: the frame's parent is the calling environment
+    lenv frame;
+    lenv_frame(&frame, e);
 
-        // Evaluate and return
-        return builtin_eval(
-            f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
+    lval *result = lval_bind(&frame, f, a);
+    if (!result) {
+        // All formals have been bound, evaluate the shared body
+        lval *body = lval_copy(f->body);
+        lval_del(f);
+        result = lval_run(&frame, body);
     } else {
-        // otherwise return partially evaluated function
-        return lval_copy(f);
+        lval_del(f);
     }
+
+    lenv_del(&frame);
+    return result;
 }
 
 
 
-/* * * * * * * * * * * * * *
-* Rosq Built In Functions *
-* * * * * * * * * * * * * */
-lval *builtin_load(lenv *e, lval *a) {
-    LASSERT_NUM(a, "load", 1);
-    LASSERT_TYPE(a, "load", 0, LVAL_STR);
+/* * * * * * * * * * * *
+*  LEXICAL ADDRESSING  *
+* * * * * * * * * * * */
+// lval_call binds the formals into a fresh frame in order, so when a lambda
+// is built we already know the slot each formal will occupy. References to
+// them anywhere in the body become slot symbols, which lenv_get tries before
+// searching. Free variables are dynamically scoped and stay plain symbols.
+// A slot symbol that ends up evaluated in some other frame (say a Q-Expression
+// handed to another function) fails the name check and falls back as well.
+
+void lval_resolve_slots(lval *v, char **names, int count) {
+    for (int i = 0; i < v->count; i++) {
+        lval *c = v->cell[i];
+        switch (lval_type(c)) {
+            case LVAL_SYM:
+                for (int j = 0; j < count; j++) {
+                    if (names[j] == lval_to_sym(c)) {
+                        v->cell[i] = lval_slot_sym(names[j], j);
+                        gc_write(v);
+                        lval_del(c);
+                        break;
+                    }
+                }
+                break;
+            case LVAL_SEXPR:
+            case LVAL_QEXPR:
+                v->cell[i] = lval_mut(c);
+                gc_write(v);
+                lval_resolve_slots(v->cell[i], names, count);
+                break;
+        }
+    }
+}
 
-    // Parse file given by string name
-    mpc_result_t r;
+// Takes ownership of body and returns it with the formals resolved
+lval *lval_resolve(lval *body, lval *formals) {
+    // Work out the frame layout: each distinct formal in order, without '&'
+    char **names = malloc(sizeof(char*) * formals->count);
+    int count = 0;
+    for (int i = 0; i < formals->count; i++) {
+        char *sym = lval_to_sym(formals->cell[i]);
+        if (sym == lsym_amp) { continue; }
+
+        int seen = 0;
+        for (int j = 0; j < count; j++) {
+            if (names[j] == sym) { seen = 1; }
+        }
+        if (!seen) { names[count++] = sym; }
+    }
 
-    if (mpc_parse_contents(a->cell[0]->str, Rosq, &r)){
-        // Read contents
-        lval *expr = lval_read(r.output);
-        mpc_ast_delete(r.output);
+    body = lval_mut(body);
+    lval_resolve_slots(body, names, count);
+    free(names);
+    return body;
+}
 
-        // Evaluate each Expression
-        while (expr->count) {
-            lval *x = lval_eval(e, lval_pop(expr, 0));
-            //If evaluation leads to error print it
-            if (x->type == LVAL_ERR) { lval_println(x); }
-            lval_del(x);
-        }
 
-        // Delete expressions and arguments
-        lval_del(expr);
-        lval_del(a);
 
-        // Return empty list
-        return lval_sexpr();
+/* * * * * * * * * * * * *
+*  BYTECODE COMPILER  *
+* * * * * * * * * * * * */
+// The first time a lambda body runs it is compiled into a flat sequence of
+// ops for a stack machine, cached on the body itself. Each op is followed by
+// its operands. The code follows lval_eval_sexpr exactly: each S-Expression
+// pushes its children and then OP_CALL applies the same rules to them.
+//
+// (if c {a} {b}) with literal branches compiles to OP_IF followed by both
+// branches inline. At run time it checks that 'if' really is the builtin and
+// c a Boolean, and otherwise calls whatever 'if' is with the two branches as
+// Q-Expressions, so rebinding 'if' still behaves.
+//
+// A lambda called from tail position takes over the calling frame and runs
+// in the same vm_run, so tail recursion needs no C stack. Free variables are
+// dynamically scoped, so caller bindings the callee does not rebind are
+// carried into its frame, see lenv_replace.
+//
+// Run with --tree-walk to evaluate bodies with lval_eval instead, which
+// eliminates tail calls the same way in lval_walk.
+
+enum {
+    OP_CONST,   // k            push consts[k]
+    OP_LOOKUP,  // k ic         push the value of symbol consts[k], see
+                //              INLINE CACHES for caches[ic]
+    OP_CALL,    // n            evaluate the top n values as an S-Expression
+    OP_TAIL,    // n            OP_CALL in tail position
+    OP_IF,      // kt ke e end  see above, e and end are op offsets
+    OP_JUMP,    // to
+    OP_RETURN
+};
 
-    } else {
-        puts("FOO2");
-        // Get parse error as string
-        char *err_msg = mpc_err_string(r.error);
-        mpc_err_delete(r.error);
-
-        // Create a new error message using it
-        lval *err = lval_err("Could not load Library %s", err_msg);
-        free(err_msg);
-        lval_del(a);
+int vm_enabled = 1;
 
-        // Cleanup and return error
-        return err;
-    }
+void lcode_emit(lcode *c, int op) {
+    c->ops = realloc(c->ops, sizeof(int) * (c->count + 1));
+    c->ops[c->count++] = op;
 }
 
-lval *builtin_print(lenv *e, lval *a) {
-    // Print each argument followed by a space
-    for (int i = 0; i < a->count; i++) {
-        lval_print(a->cell[i]); putchar(' ');
-    }
+int lcode_const(lcode *c, lval *v) {
+    c->consts = realloc(c->consts, sizeof(lval*) * (c->nconsts + 1));
+    c->consts[c->nconsts] = lval_copy(v);
+    return c->nconsts++;
+}
 
-    putchar('\n');
-    lval_del(a);
+void lcode_push(lcode *c, int n) {
+    c->depth += n;
+    if (c->depth > c->max_depth) { c->max_depth = c->depth; }
+}
 
-    return lval_sexpr();
+void lcode_sexpr(lcode *c, lval *v, int tail);
+
+void lcode_expr(lcode *c, lval *x) {
+    if (lval_type(x) == LVAL_SYM) {
+        lcode_emit(c, OP_LOOKUP);
+        lcode_emit(c, lcode_const(c, x));
+        lcode_emit(c, c->ncaches++);
+        lcode_push(c, 1);
+        return;
+    } else if (lval_type(x) == LVAL_SEXPR) {
+        lcode_sexpr(c, x, 0);
+        return;
+    } else {
+        lcode_emit(c, OP_CONST);
+    }
+    lcode_emit(c, lcode_const(c, x));
+    lcode_push(c, 1);
 }
 
-lval *builtin_error(lenv *e, lval *a) {
-    LASSERT_NUM(a, "error", 1);
-    LASSERT_TYPE(a, "error", 0, LVAL_STR);
+// (if c {a} {b}), where 'if' may turn out to be anything at run time
+int lcode_is_if(lval *v) {
+    return v->count == 4
+        && lval_is_sym(v->cell[0])
+        && lval_to_sym(v->cell[0]) == lsym_if
+        && lval_type(v->cell[2]) == LVAL_QEXPR
+        && lval_type(v->cell[3]) == LVAL_QEXPR;
+}
 
-    // Construct error from first argument
-    lval *err = lval_err(a->cell[0]->str);
+void lcode_sexpr(lcode *c, lval *v, int tail) {
+    if (lcode_is_if(v)) {
+        lcode_expr(c, v->cell[0]);
+        lcode_expr(c, v->cell[1]);
+
+        // Falling back to a plain call pushes both branches as well
+        lcode_push(c, 2);
+        c->depth -= 4;
+
+        lcode_emit(c, OP_IF);
+        lcode_emit(c, lcode_const(c, v->cell[2]));
+        lcode_emit(c, lcode_const(c, v->cell[3]));
+        int at = c->count;
+        lcode_emit(c, 0);
+        lcode_emit(c, 0);
+
+        lcode_sexpr(c, v->cell[2], tail);
+        c->depth--;
+        lcode_emit(c, OP_JUMP);
+        int jump = c->count;
+        lcode_emit(c, 0);
+
+        c->ops[at] = c->count;
+        lcode_sexpr(c, v->cell[3], tail);
+        c->ops[at + 1] = c->ops[jump] = c->count;
+        return;
+    }
 
-    // Delete arguments and return
-    lval_del(a);
-    return err;
+    for (int i = 0; i < v->count; i++) { lcode_expr(c, v->cell[i]); }
+    lcode_emit(c, tail ? OP_TAIL : OP_CALL);
+    lcode_emit(c, v->count);
+
+    // The empty S-Expression pushes a new one
+    if (v->count == 0) { lcode_push(c, 1); }
+    else { c->depth -= v->count - 1; }
 }
 
-lval *builtin_def(lenv *e, lval *a) {
-    return builtin_var(e, a, "def");
+lcode *lcode_compile(lval *body) {
+    lcode *c = calloc(1, sizeof(lcode));
+    lcode_sexpr(c, body, 1);
+    lcode_emit(c, OP_RETURN);
+    c->caches = calloc(c->ncaches ? c->ncaches : 1, sizeof(lcache));
+    return c;
 }
 
-lval *builtin_put(lenv *e, lval *a) {
-    return builtin_var(e, a, "=");
+void lcode_del(lcode *c) {
+    free(c->ops);
+    free(c->consts);
+    free(c->caches);
+    free(c);
 }
 
-lval *builtin_var(lenv *e, lval *a, char *func) {
-    LASSERT_TYPE(a, func, 0, LVAL_QEXPR);
 
-    lval *syms = a->cell[0];
-    for (int i = 0; i < syms->count; i++) {
-        LASSERT(a, (syms->cell[i]->type == LVAL_SYM),
-        "Function '%s' cannot define non-symbol. "
-        "Got %s, Expected %s.", func,
-        ltype_name(syms->cell[i]->type),
-        ltype_name(LVAL_SYM));
+
+/* * * * * * * * * * *
+*  BYTECODE VM  *
+* * * * * * * * * * */
+// All running bodies share one value stack, which the collector scans as a
+// root. It may be reallocated by any call, so it is always indexed afresh.
+
+lval **vm_stack = NULL;
+int vm_sp = 0;
+int vm_size = 0;
+
+void vm_reserve(int n) {
+    if (vm_sp + n <= vm_size) { return; }
+    while (vm_sp + n > vm_size) { vm_size = vm_size ? vm_size * 2 : 1024; }
+    vm_stack = realloc(vm_stack, sizeof(lval*) * vm_size);
+}
+
+// Pop the top n values and evaluate them as lval_eval_sexpr would
+lval *vm_call(lenv *e, int n) {
+    vm_sp -= n;
+    lval **v = &vm_stack[vm_sp];
+
+    // Error Checking
+    for (int i = 0; i < n; i++) {
+        if (lval_type(v[i]) == LVAL_ERR) { return v[i]; }
     }
 
-    LASSERT(a, (syms->count == a->count-1),
-    "FUnction '%s' passed too many arguments for symbols."
-    "Got %i, Expected %i.", func, syms->count, a->count-1);
+    // Empty and single Expressions
+    if (n == 0) { return lval_sexpr(); }
+    if (n == 1) { return v[0]; }
 
-    for (int i = 0; i < syms->count; i++) {
-        // If 'def' define in global. if 'put' define in locally
-        if (strcmp(func, "def") == 0) {
-            lenv_def(e, syms->cell[i], a->cell[i+1]);
-        }
+    // Ensure First Element is a function after evaluation
+    lval *f = v[0];
+    if (lval_type(f) != LVAL_FUN) {
+        return lval_err(
+            "S-Expression starts with incorrect type. "
+            "Got %s, Expected %s.",
+            ltype_name(lval_type(f)), ltype_name(LVAL_FUN));
+    }
 
-        if (strcmp(func, "=") == 0) {
-            lenv_put(e, syms->cell[i], a->cell[i+1]);
+    // Arithmetic on two fixnums needs no argument list
+    if (n == 3 && f->builtin && lval_is_fixnum(v[1]) && lval_is_fixnum(v[2])) {
+        lval *x = lval_fix_call(f->builtin, v[1], v[2]);
+        if (x) {
+            lval_del(f);
+            return x;
         }
     }
 
-    lval_del(a);
-    return lval_sexpr();
+    lval *a = lval_sexpr();
+    a->count = n - 1;
+    a->cell = pool_array_alloc(a->count);
+    memcpy(a->cell, &v[1], sizeof(lval*) * a->count);
+    return lval_call(e, f, a);
 }
 
-lval *builtin_lamba(lenv *e, lval *a) {
-    // check Two arguments, both Q-Expressions
-    LASSERT_NUM(a, "\\", 2);
-    LASSERT_TYPE(a, "\\", 0, LVAL_QEXPR);
-    LASSERT_TYPE(a, "\\", 1, LVAL_QEXPR);
+// The code for a lambda body, compiled the first time it is needed
+lcode *vm_code(lval *body) {
+    if (!body->code) {
+        body->code = lcode_compile(body);
+        // Keep the code with the body, never with a private copy of it
+        body->gc |= GC_SHARED;
+        gc_write(body);
+    }
+    vm_reserve(body->code->max_depth);
+    return body->code;
+}
 
-    // Check first Q-Expression contains only Symbols
-    for (int i = 0; i < a->cell[0]->count; i++) {
-        LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
-        "Cannot define non-symbol. Got %s, Expected %s.",
-        ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
+// Run a lambda body in frame e, taking ownership of the body
+lval *vm_run(lenv *e, lval *body) {
+    gc_root(&body);
+    lcode *c = vm_code(body);
+    int *ip = c->ops;
+
+#if defined(__GNUC__)
+    static void *labels[] = {
+        &&L_OP_CONST, &&L_OP_LOOKUP, &&L_OP_CALL, &&L_OP_TAIL,
+        &&L_OP_IF, &&L_OP_JUMP, &&L_OP_RETURN
+    };
+    #define VM_DISPATCH() goto *labels[*ip++]
+    #define VM_OP(name) L_##name:
+    VM_DISPATCH();
+#else
+    #define VM_DISPATCH() continue
+    #define VM_OP(name) case name:
+    for (;;) switch (*ip++) {
+#endif
+
+    VM_OP(OP_CONST) {
+        vm_stack[vm_sp++] = lval_copy(c->consts[*ip++]);
+        VM_DISPATCH();
+    }
 
+    VM_OP(OP_LOOKUP) {
+        lcache *ic = &c->caches[ip[1]];
+        vm_stack[vm_sp++] = ic->version == lenv_version
+            ? lval_copy(ic->val)
+            : lenv_get_cached(e, c->consts[ip[0]], ic);
+        ip += 2;
+        VM_DISPATCH();
     }
 
-    // Pop first two arguments and pass them to lval_lambda
-    lval *formals = lval_pop(a, 0);
-    lval *body = lval_pop(a, 0);
-    lval_del(a);
+    VM_OP(OP_CALL) {
+        // Safepoint: everything live is on the stack or in a frame
+        if (gc_pending) { gc_collect(); }
+        lval *x = vm_call(e, *ip++);
+        vm_stack[vm_sp++] = x;
+        VM_DISPATCH();
+    }
 
-    return lval_lambda(formals, body);
-}
+    VM_OP(OP_TAIL) {
+        if (gc_pending) { gc_collect(); }
+        int n = *ip++;
+        lval **v = &vm_stack[vm_sp - n];
 
-//  builtin_len() returns the number of elements in a Q-Expression
-lval *builtin_len(lenv *e, lval *a) {
-    LASSERT_TYPE(a, "len", 0, LVAL_QEXPR);
-    LASSERT_NUM(a, "len", 1);
+        // Only a call to a lambda can replace this one
+        int lambda = n >= 2 && lval_type(v[0]) == LVAL_FUN && !v[0]->builtin;
+        for (int i = 1; lambda && i < n; i++) {
+            if (lval_type(v[i]) == LVAL_ERR) { lambda = 0; }
+        }
+        if (!lambda) {
+            lval *x = vm_call(e, n);
+            vm_stack[vm_sp++] = x;
+            VM_DISPATCH();
+        }
 
-    lval *count = lval_num(a->cell[0]->count);
+        vm_sp -= n;
+        lval *f = v[0];
+        lval *a = lval_sexpr();
+        a->count = n - 1;
+        a->cell = pool_array_alloc(a->count);
+        memcpy(a->cell, &v[1], sizeof(lval*) * a->count);
+
+        lenv next;
+        lenv_frame(&next, e);
+        lval *x = lval_bind(&next, f, a);
+        if (x) {
+            lval_del(f);
+            lenv_del(&next);
+            vm_stack[vm_sp++] = x;
+            VM_DISPATCH();
+        }
 
-    return count;
-}
+        body = lval_copy(f->body);
+        lval_del(f);
 
-//  builtin_head() returns just the first element, deletes rest
-lval *builtin_head(lenv *e, lval *a) {
-    LASSERT_NUM(a, "head", 1);
-    LASSERT_NOT_EMPTY(a, "head", 0);
-    LASSERT_TYPE(a, "head", 0, LVAL_QEXPR);
+        // The callee's frame takes the place of e
+        lenv_replace(e, &next);
+        c = vm_code(body);
+        ip = c->ops;
+        VM_DISPATCH();
+    }
 
-    // Otherwise take first argument
-    lval *v = lval_take(a, 0);
+    VM_OP(OP_IF) {
+        lval *f = vm_stack[vm_sp - 2];
+        lval *cond = vm_stack[vm_sp - 1];
+        if (lval_type(f) == LVAL_FUN && f->builtin == builtin_if
+            && lval_is_bool(cond)) {
+            vm_sp -= 2;
+            ip = lval_truth(cond) ? ip + 4 : c->ops + ip[2];
+        } else {
+            vm_stack[vm_sp++] = lval_copy(c->consts[ip[0]]);
+            vm_stack[vm_sp++] = lval_copy(c->consts[ip[1]]);
+            ip = c->ops + ip[3];
+            if (gc_pending) { gc_collect(); }
+            lval *x = vm_call(e, 4);
+            vm_stack[vm_sp++] = x;
+        }
+        VM_DISPATCH();
+    }
+
+    VM_OP(OP_JUMP) {
+        ip = c->ops + *ip;
+        VM_DISPATCH();
+    }
+
+    VM_OP(OP_RETURN) {
+        gc_unroot(1);
+        return vm_stack[--vm_sp];
+    }
+
+#if !defined(__GNUC__)
+    }
+#endif
+    #undef VM_DISPATCH
+    #undef VM_OP
+}
+
+
+/* * * * * * * *
+*  READER  *
+* * * * * * * */
+// Builds lvals straight from source text in one pass, without going through
+// an mpc syntax tree. It accepts exactly what the grammar in main() accepts:
+// tokens are tried in the grammar's order, so 12ab reads as 12 then ab, and
+// a - is only part of a number when a digit follows it. The mpc parser is
+// kept as the reference, --mpc-reader loads files with it instead, and
+// --mpc-packrat does the same with the grammar's rules memoised.
+//
+// Errors are reported as file:line:column, counting from 1.
+
+int reader_mpc = 0;
+
+typedef struct {
+    char *s;            // next byte
+    char *end;
+    char *line_start;
+    int line;
+    char *filename;
+    lval *err;          // the first error, which stops the read
+} lreader;
+
+static inline int lreader_symbol_char(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+        || (c >= '0' && c <= '9') || (c && strchr("_+-*/\\=<>|!&", c));
+}
+
+static inline int lreader_digit(lreader *r, char *s) {
+    return s < r->end && *s >= '0' && *s <= '9';
+}
+
+lval *lreader_error(lreader *r, char *at, char *what) {
+    if (!r->err) {
+        r->err = lval_err("%s:%d:%d: error: %s", r->filename, r->line,
+            (int)(at - r->line_start) + 1, what);
+    }
+    return NULL;
+}
+
+// Skip whitespace and comments
+void lreader_skip(lreader *r) {
+    while (r->s < r->end) {
+        switch (*r->s) {
+            case '\n': r->line++; r->line_start = ++r->s; break;
+            case ' ': case '\t': case '\r': case '\f': case '\v': r->s++; break;
+            case ';':
+                while (r->s < r->end && *r->s != '\n' && *r->s != '\r') { r->s++; }
+                break;
+            default: return;
+        }
+    }
+}
+
+// -?[0-9]+(\.[0-9]+)?([eE][-+]?[0-9]+)? starting at r->s, or NULL if there
+// is no number there
+lval *lreader_number(lreader *r) {
+    char *s = r->s;
+    if (*s == '-') { s++; }
+    if (!lreader_digit(r, s)) { return NULL; }
+
+    // Integers that surely fit in a long need no copy and no strtol
+    long x = 0;
+    char *digits = s;
+    while (lreader_digit(r, s) && s - digits < 18) { x = x * 10 + (*s++ - '0'); }
+    while (lreader_digit(r, s)) { s++; }
+    int plain = s - digits <= 18;
+
+    if (s < r->end && *s == '.' && lreader_digit(r, s + 1)) {
+        s++;
+        while (lreader_digit(r, s)) { s++; }
+        plain = 0;
+    }
+    if (s < r->end && (*s == 'e' || *s == 'E')) {
+        char *e = s + 1;
+        if (e < r->end && (*e == '-' || *e == '+')) { e++; }
+        if (lreader_digit(r, e)) {
+            s = e;
+            while (lreader_digit(r, s)) { s++; }
+            plain = 0;
+        }
+    }
+
+    char *start = r->s;
+    r->s = s;
+    if (plain) { return lval_num(*start == '-' ? -x : x); }
+
+    // strtod and strtol want a NUL, and would read more than the grammar
+    int n = s - start;
+    char small[64];
+    char *buf = n < (int)sizeof(small) ? small : malloc(n + 1);
+    memcpy(buf, start, n);
+    buf[n] = '\0';
+    lval *v = lval_read_num(buf);
+    if (buf != small) { free(buf); }
+    return v;
+}
+
+lval *lreader_string(lreader *r) {
+    char *open = r->s;
+    char *open_line_start = r->line_start;
+    int open_line = r->line;
+
+    char *s = open + 1;
+    while (s < r->end && *s != '"') {
+        if (*s == '\\') { s++; if (s == r->end) { break; } }
+        if (*s == '\n') { r->line++; r->line_start = s + 1; }
+        s++;
+    }
+    if (s == r->end) {
+        // Point at the opening quote, not at the end of the file
+        r->line = open_line;
+        r->line_start = open_line_start;
+        return lreader_error(r, open, "unterminated string");
+    }
+    r->s = s + 1;
+
+    // Unescaping only ever shortens, so n bytes of room is enough
+    int n = s - (open + 1);
+    if (n > LVAL_SSO_MAX) {
+        lval *v = lval_str_new(n, n);
+        v->slen = lval_unescape(v->str, open + 1, n);
+        v->str[v->slen] = '\0';
+        lval_strbuf(v)->used = v->slen;
+        if (v->slen <= LVAL_SSO_MAX) {
+            lval *x = lval_str_n(v->str, v->slen);
+            lval_del(v);
+            return x;
+        }
+        return v;
+    }
+    char buf[LVAL_SSO_MAX + 1];
+    return lval_str_n(buf, lval_unescape(buf, open + 1, n));
+}
+
+lval *lreader_expr(lreader *r);
+
+// The expressions up to the byte close, which is at r->s once they are read
+lval *lreader_list(lreader *r, lval *x, char close) {
+    char *open = r->s - 1;
+    char *open_line_start = r->line_start;
+    int open_line = r->line;
+
+    lreader_skip(r);
+    while (r->s < r->end && *r->s != close) {
+        lval *v = lreader_expr(r);
+        if (!v) { lval_del(x); return NULL; }
+        x = lval_add(x, v);
+        lreader_skip(r);
+    }
+
+    if (r->s == r->end) {
+        char what[64];
+        snprintf(what, sizeof(what), "missing '%c' for '%c' opened at %d:%d",
+            close, *open, open_line, (int)(open - open_line_start) + 1);
+        lval_del(x);
+        return lreader_error(r, r->s, what);
+    }
+    r->s++;
+    return x;
+}
+
+// One expression starting at r->s, which is not whitespace, or NULL
+lval *lreader_expr(lreader *r) {
+    char c = *r->s;
+    if (c == '"') { return lreader_string(r); }
+    if (c == '(') { r->s++; return lreader_list(r, lval_sexpr(), ')'); }
+    if (c == '{') {
+        r->s++;
+        lval *x = lreader_list(r, lval_qexpr(), '}');
+        return x ? lval_read_cons(x) : NULL;
+    }
+
+    lval *v = lreader_number(r);
+    if (v) { return v; }
+
+    char *s = r->s;
+    while (s < r->end && lreader_symbol_char(*s)) { s++; }
+    if (s == r->s) {
+        char what[32];
+        if (c == ')' || c == '}') {
+            snprintf(what, sizeof(what), "unexpected '%c'", c);
+        } else {
+            snprintf(what, sizeof(what), "unexpected byte 0x%02x", (unsigned char)c);
+        }
+        return lreader_error(r, r->s, what);
+    }
+    char *sym = lsym_intern_n(r->s, s - r->s);
+    r->s = s;
+    return (lval*)((intptr_t)sym | 4);
+}
+
+// Read the n bytes at src into an S-Expression of everything in them, or an
+// Error saying where in filename they stop making sense
+lval *lval_read_src(char *src, size_t n, char *filename) {
+    lreader r = { src, src + n, src, 1, filename, NULL };
+    lval *x = lval_sexpr();
+
+    lreader_skip(&r);
+    while (r.s < r.end) {
+        lval *v = lreader_expr(&r);
+        if (!v) { break; }
+        x = lval_add(x, v);
+        lreader_skip(&r);
+    }
+    lval_read_cons_reset();
+
+    if (r.err) {
+        lval_del(x);
+        return r.err;
+    }
+    return x;
+}
+
+// Read the whole file with the reader, or with mpc if --mpc-reader was given
+lval *lval_read_file(char *filename) {
+    if (reader_mpc) {
+        mpc_result_t r;
+        if (!mpc_parse_contents(filename, Rosq, &r)) {
+            char *msg = mpc_err_string(r.error);
+            mpc_err_delete(r.error);
+            lval *err = lval_err("%s", msg);
+            free(msg);
+            return err;
+        }
+        lval *x = lval_read(r.output);
+        mpc_ast_delete(r.output);
+        return x;
+    }
+
+    FILE *f = fopen(filename, "rb");
+    if (!f) { return lval_err("%s: %s", filename, strerror(errno)); }
+
+    size_t n = 0, cap = 1 << 16;
+    char *src = malloc(cap);
+    size_t got;
+    while ((got = fread(src + n, 1, cap - n, f)) > 0) {
+        n += got;
+        if (n == cap) { src = realloc(src, cap *= 2); }
+    }
+    fclose(f);
+
+    lval *x = lval_read_src(src, n, filename);
+    free(src);
+    return x;
+}
+
+
+/* * * * * * * * * * * * * *
+* Rosq Built In Functions *
+* * * * * * * * * * * * * */
+lval *builtin_load(lenv *e, lval *a) {
+    LASSERT_NUM(a, "load", 1);
+    LASSERT_TYPE(a, "load", 0, LVAL_STR);
+
+    // Read file given by string name
+    lval *name = a->cell[0];
+    char *filename = malloc(lval_str_len(name) + 1);
+    memcpy(filename, lval_str_ptr(name), lval_str_len(name));
+    filename[lval_str_len(name)] = '\0';
+    lval *expr = lval_read_file(filename);
+    free(filename);
+
+    if (lval_type(expr) != LVAL_ERR) {
+        // Evaluate each Expression in place, popping them off the front
+        // would shift the rest down every time
+        gc_root(&a); gc_root(&expr);
+        for (int i = 0; i < expr->count; i++) {
+            lval *x = lval_eval(e, expr->cell[i]);
+            expr->cell[i] = x;
+            gc_write(expr);
+            //If evaluation leads to error print it
+            if (lval_type(x) == LVAL_ERR) { lval_println(x); }
+        }
+        gc_unroot(2);
+
+        // Delete expressions and arguments
+        lval_del(expr);
+        lval_del(a);
+
+        // Return empty list
+        return lval_sexpr();
+
+    } else {
+        // Create a new error message from the read error
+        lval *err = lval_err("Could not load Library %s", lval_str_ptr(expr));
+        lval_del(expr);
+        lval_del(a);
+
+        // Cleanup and return error
+        return err;
+    }
+}
+
+lval *builtin_print(lenv *e, lval *a) {
+    // Print each argument followed by a space
+    for (int i = 0; i < a->count; i++) {
+        lval_print(a->cell[i]); putchar(' ');
+    }
+
+    putchar('\n');
+    lval_del(a);
+
+    return lval_sexpr();
+}
+
+lval *builtin_error(lenv *e, lval *a) {
+    LASSERT_NUM(a, "error", 1);
+    LASSERT_TYPE(a, "error", 0, LVAL_STR);
+
+    // Construct error from first argument
+    lval *err = lval_err("%.*s", lval_str_len(a->cell[0]), lval_str_ptr(a->cell[0]));
+
+    // Delete arguments and return
+    lval_del(a);
+    return err;
+}
+
+//  builtin_substr() returns n characters of a string from an index on,
+//  sharing its storage
+lval *builtin_substr(lenv *e, lval *a) {
+    LASSERT_NUM(a, "substr", 3);
+    LASSERT_TYPE(a, "substr", 0, LVAL_STR);
+    LASSERT_TYPE(a, "substr", 1, LVAL_NUM);
+    LASSERT_TYPE(a, "substr", 2, LVAL_NUM);
+
+    int len = lval_str_len(a->cell[0]);
+    long i = lval_to_num(a->cell[1]);
+    long n = lval_to_num(a->cell[2]);
+    LASSERT(a, i >= 0 && i <= len,
+        "Function '%s' passed index %li, outside a string of length %i.",
+        "substr", i, len);
+    LASSERT(a, n >= 0 && n <= len - i,
+        "Function '%s' passed length %li, past the end of a string of length %i.",
+        "substr", n, len);
+
+    return lval_str_slice(lval_take(a, 0), i, n);
+}
+
+lval *builtin_def(lenv *e, lval *a) {
+    return builtin_var(e, a, "def");
+}
+
+lval *builtin_put(lenv *e, lval *a) {
+    return builtin_var(e, a, "=");
+}
+
+lval *builtin_var(lenv *e, lval *a, char *func) {
+    LASSERT_TYPE(a, func, 0, LVAL_QEXPR);
+
+    lval *syms = a->cell[0];
+    for (int i = 0; i < syms->count; i++) {
+        LASSERT(a, (lval_type(syms->cell[i]) == LVAL_SYM),
+        "Function '%s' cannot define non-symbol. "
+        "Got %s, Expected %s.", func,
+        ltype_name(lval_type(syms->cell[i])),
+        ltype_name(LVAL_SYM));
+    }
+
+    LASSERT(a, (syms->count == a->count-1),
+    "FUnction '%s' passed too many arguments for symbols."
+    "Got %i, Expected %i.", func, syms->count, a->count-1);
+
+    for (int i = 0; i < syms->count; i++) {
+        // If 'def' define in global. if 'put' define in locally
+        if (strcmp(func, "def") == 0) {
+            lenv_def(e, syms->cell[i], a->cell[i+1]);
+        }
+
+        if (strcmp(func, "=") == 0) {
+            lenv_put(e, syms->cell[i], a->cell[i+1]);
+        }
+    }
+
+    lval_del(a);
+    return lval_sexpr();
+}
+
+lval *builtin_lamba(lenv *e, lval *a) {
+    // check Two arguments, both Q-Expressions
+    LASSERT_NUM(a, "\\", 2);
+    LASSERT_TYPE(a, "\\", 0, LVAL_QEXPR);
+    LASSERT_TYPE(a, "\\", 1, LVAL_QEXPR);
+
+    // Check first Q-Expression contains only Symbols
+    for (int i = 0; i < a->cell[0]->count; i++) {
+        LASSERT(a, (lval_type(a->cell[0]->cell[i]) == LVAL_SYM),
+        "Cannot define non-symbol. Got %s, Expected %s.",
+        ltype_name(lval_type(a->cell[0]->cell[i])), ltype_name(LVAL_SYM));
+
+    }
+
+    // Pop first two arguments and pass them to lval_lambda
+    lval *formals = lval_pop(a, 0);
+    lval *body = lval_pop(a, 0);
+    lval_del(a);
+
+    return lval_lambda(formals, lval_resolve(body, formals));
+}
+
+//  builtin_len() returns the number of elements in a Q-Expression
+lval *builtin_len(lenv *e, lval *a) {
+    LASSERT_NUM(a, "len", 1);
+
+    // Strings know their length too
+    if (lval_type(a->cell[0]) == LVAL_STR) {
+        lval *n = lval_num(lval_str_len(a->cell[0]));
+        lval_del(a);
+        return n;
+    }
+    LASSERT_TYPE(a, "len", 0, LVAL_QEXPR);
+
+    lval *count = lval_num(a->cell[0]->count);
+    lval_del(a);
+
+    return count;
+}
+
+//  builtin_head() returns just the first element, deletes rest
+lval *builtin_head(lenv *e, lval *a) {
+    LASSERT_NUM(a, "head", 1);
+    LASSERT_TYPE(a, "head", 0, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY(a, "head", 0);
+
+    // Otherwise take first argument, and view just its first element
+    return lval_slice(lval_take(a, 0), 0, 1);
+}
+
+//  builtin_tail() deletes first element, returns rest
+lval *builtin_tail(lenv *e, lval *a) {
+    // Check error conditions
+    LASSERT_NUM(a, "tail", 1);
+    LASSERT_TYPE(a, "tail", 0, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY(a, "tail", 0);
+
+    // Take first argument, and view all but its first element
+    lval *v = lval_take(a, 0);
+    return lval_slice(v, 1, v->count - 1);
+}
+
+//  builtin_init() returns all of a Q-Expression except the final element
+lval *builtin_init(lenv *e, lval *a) {
+    LASSERT_NUM(a, "init",  1);
+    LASSERT_TYPE(a, "init", 0, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY(a, "init", 0);
+
+    lval *v = lval_take(a, 0);
+    return lval_slice(v, 0, v->count - 1);
+}
+
+//  builtin_list() turns things into a list S-Expression
+lval *builtin_list(lenv *e, lval *a) {
+    a->type = LVAL_QEXPR;
+    return a;
+}
+
+// builtin_join() joins 2+ Q-Expressions
+lval *builtin_join(lenv *e, lval *a) {
+    // Make sure args are strings or qexprs, and all the same type.
+    int t = lval_type(a->cell[0]);
+    for (int i = 0; i < a->count; i++) {
+        int ti = lval_type(a->cell[i]);
+        if (ti != LVAL_QEXPR && ti != LVAL_STR) {
+            lval_del(a);
+            return lval_err("'Join' needs a string or a Q-expression. "
+                "Got %s", ltype_name(ti));
+        } else if (ti != t) {
+            lval_del(a);
+            return lval_err("'Join' needs all args to be the same type. "
+                "Got %s and %s, for example.", ltype_name(t),
+                ltype_name(ti));
+        }
+    }
+
+    lval *x = lval_pop(a, 0);
+
+    while (a->count) {
+        x = lval_join(x, lval_pop(a, 0));
+    }
+
+    lval_del(a);
+    return x;
+}
+
+// builtin_cons() takes a value and a Q-Expression and
+// appends the value to the front of the Q-Expression
+lval *builtin_cons(lenv *e, lval *a) {
+    LASSERT_NUM(a, "cons", 2);
+    LASSERT_TYPE(a, "cons", 0, LVAL_NUM);
+    LASSERT_TYPE(a, "cons", 1, LVAL_QEXPR);
+    // New Q-Expression
+    lval *newQ = lval_qexpr();
+    newQ = lval_add(newQ, lval_pop(a, 0));
+    lval *oldQ = lval_take(a, 0);
+    newQ = lval_join(newQ, oldQ);
+
+    return newQ;
+}
+
+//  builtin_eval() evaluates contents of a Q-Expression
+lval *builtin_eval(lenv *e, lval *a) {
+    LASSERT_NUM(a, "eval", 1);
+    LASSERT_TYPE(a, "eval", 0, LVAL_QEXPR);
+    lval *x = lval_mut(lval_take(a, 0));
+    x->type = LVAL_SEXPR;
+    return lval_eval(e, x);
+}
+
+/* * * * * * * * * * *
+*  LIST LIBRARY  *
+* * * * * * * * * * */
+// Native versions of the prelude's list functions. They walk the list by
+// index instead of taking its tail at every step, so they are linear, and
+// build their result in one allocation where the length is known. Like the
+// prelude they see elements through 'fst', which evaluates them, and they
+// give the same errors the prelude versions end up with: running off the
+// end is the error from 'head' or 'tail' of {}.
+//
+// Anything that evaluates keeps 'a' and its result rooted, since a
+// collection may move them.
+
+// What (fst l) gives for an element v of l
+lval *lval_fst(lenv *e, lval *v) {
+    return lval_eval(e, lval_copy(v));
+}
+
+// Apply f to one or two arguments
+lval *lval_apply1(lenv *e, lval *f, lval *x) {
+    return lval_call(e, lval_copy(f), lval_add(lval_sexpr(), x));
+}
+
+lval *lval_apply2(lenv *e, lval *f, lval *x, lval *y) {
+    return lval_call(e, lval_copy(f), lval_add(lval_add(lval_sexpr(), x), y));
+}
+
+// A Q-Expression of n elements, all 0 until they are filled in
+lval *lval_qexpr_n(int n) {
+    lval *x = lval_qexpr();
+    x->count = n;
+    x->cell = pool_array_alloc(n);
+    for (int i = 0; i < n; i++) { x->cell[i] = lval_num(0); }
+    return x;
+}
+
+lval *lval_err_head_empty(void) {
+    return lval_err("Function '%s' passed {} for argument %i.", "head", 0);
+}
+
+lval *lval_err_tail_empty(void) {
+    return lval_err("Function '%s' passed {} for argument %i.", "tail", 0);
+}
+
+lval *builtin_nth(lenv *e, lval *a) {
+    LASSERT_NUM(a, "nth", 2);
+    LASSERT_TYPE(a, "nth", 0, LVAL_NUM);
+    LASSERT_TYPE(a, "nth", 1, LVAL_QEXPR);
+
+    long n = lval_to_num(a->cell[0]);
+    lval *l = a->cell[1];
+    if (n == l->count) { return lval_err_head_empty(); }
+    if (n < 0 || n > l->count) { return lval_err_tail_empty(); }
+    return lval_fst(e, l->cell[n]);
+}
+
+lval *builtin_last(lenv *e, lval *a) {
+    LASSERT_NUM(a, "last", 1);
+    LASSERT_TYPE(a, "last", 0, LVAL_QEXPR);
+
+    lval *l = a->cell[0];
+    if (l->count == 0) { return lval_err_tail_empty(); }
+    return lval_fst(e, l->cell[l->count - 1]);
+}
+
+lval *builtin_map(lenv *e, lval *a) {
+    LASSERT_NUM(a, "map", 2);
+    LASSERT_TYPE(a, "map", 0, LVAL_FUN);
+    LASSERT_TYPE(a, "map", 1, LVAL_QEXPR);
+
+    // Every element is mapped even after an error, the first error wins
+    lval *x = lval_qexpr_n(a->cell[1]->count);
+    lval *err = NULL;
+    gc_root(&a); gc_root(&x); gc_root(&err);
+    for (int i = 0; i < x->count; i++) {
+        lval *v = lval_fst(e, a->cell[1]->cell[i]);
+        if (lval_type(v) != LVAL_ERR) { v = lval_apply1(e, a->cell[0], v); }
+        if (lval_type(v) == LVAL_ERR && !err) { err = v; }
+        x->cell[i] = v;
+        gc_write(x);
+    }
+    gc_unroot(3);
+    return err ? err : x;
+}
+
+lval *builtin_filter(lenv *e, lval *a) {
+    LASSERT_NUM(a, "filter", 2);
+    LASSERT_TYPE(a, "filter", 0, LVAL_FUN);
+    LASSERT_TYPE(a, "filter", 1, LVAL_QEXPR);
+
+    lval *x = lval_qexpr();
+    lval *err = NULL;
+    gc_root(&a); gc_root(&x); gc_root(&err);
+    for (int i = 0; i < a->cell[1]->count; i++) {
+        lval *p = lval_fst(e, a->cell[1]->cell[i]);
+        if (lval_type(p) != LVAL_ERR) { p = lval_apply1(e, a->cell[0], p); }
+
+        // The prelude passes the predicate straight to 'if'
+        if (lval_type(p) != LVAL_ERR && lval_type(p) != LVAL_BOOL) {
+            p = lval_err("Function '%s' passed incorrect type for argument %i. "
+                "Got %s, Expected %s.", "if", 0,
+                ltype_name(lval_type(p)), ltype_name(LVAL_BOOL));
+        }
+        if (lval_type(p) == LVAL_ERR) {
+            if (!err) { err = p; }
+        } else if (lval_truth(p)) {
+            x = lval_add(x, lval_copy(a->cell[1]->cell[i]));
+        }
+    }
+    gc_unroot(3);
+    return err ? err : x;
+}
+
+lval *builtin_reverse(lenv *e, lval *a) {
+    LASSERT_NUM(a, "reverse", 1);
+    LASSERT_TYPE(a, "reverse", 0, LVAL_QEXPR);
+
+    lval *l = a->cell[0];
+    lval *x = lval_qexpr_n(l->count);
+    for (int i = 0; i < l->count; i++) {
+        x->cell[i] = lval_copy(l->cell[l->count - 1 - i]);
+    }
+    lval_del(a);
+    return x;
+}
+
+lval *builtin_foldl(lenv *e, lval *a) {
+    LASSERT_NUM(a, "foldl", 3);
+    LASSERT_TYPE(a, "foldl", 0, LVAL_FUN);
+    LASSERT_TYPE(a, "foldl", 2, LVAL_QEXPR);
+
+    // Stops at the first error, like the prelude's tail call would
+    lval *z = lval_copy(a->cell[1]);
+    gc_root(&a); gc_root(&z);
+    for (int i = 0; i < a->cell[2]->count; i++) {
+        lval *v = lval_fst(e, a->cell[2]->cell[i]);
+        if (lval_type(v) == LVAL_ERR) { z = v; break; }
+        z = lval_apply2(e, a->cell[0], z, v);
+        if (lval_type(z) == LVAL_ERR) { break; }
+    }
+    gc_unroot(2);
+    return z;
+}
+
+lval *builtin_foldr(lenv *e, lval *a) {
+    LASSERT_NUM(a, "foldr", 3);
+    LASSERT_TYPE(a, "foldr", 0, LVAL_FUN);
+    LASSERT_TYPE(a, "foldr", 2, LVAL_QEXPR);
+
+    // The prelude evaluates every element on the way down, then applies f
+    // on the way back up unless an element or a later result is an error
+    lval *xs = lval_qexpr_n(a->cell[2]->count);
+    lval *z = lval_copy(a->cell[1]);
+    gc_root(&a); gc_root(&xs); gc_root(&z);
+    for (int i = 0; i < xs->count; i++) {
+        lval *v = lval_fst(e, a->cell[2]->cell[i]);
+        xs->cell[i] = v;
+        gc_write(xs);
+    }
+    for (int i = xs->count - 1; i >= 0; i--) {
+        if (lval_type(xs->cell[i]) == LVAL_ERR) {
+            z = xs->cell[i];
+        } else if (lval_type(z) != LVAL_ERR) {
+            z = lval_apply2(e, a->cell[0], lval_copy(xs->cell[i]), z);
+        }
+    }
+    gc_unroot(3);
+    return z;
+}
+
+lval *builtin_take(lenv *e, lval *a) {
+    LASSERT_NUM(a, "take", 2);
+    LASSERT_TYPE(a, "take", 0, LVAL_NUM);
+    LASSERT_TYPE(a, "take", 1, LVAL_QEXPR);
+
+    long n = lval_to_num(a->cell[0]);
+    lval *l = a->cell[1];
+    if (n < 0 || n > l->count) { return lval_err_head_empty(); }
+
+    return lval_slice(lval_take(a, 1), 0, n);
+}
+
+lval *builtin_drop(lenv *e, lval *a) {
+    LASSERT_NUM(a, "drop", 2);
+    LASSERT_TYPE(a, "drop", 0, LVAL_NUM);
+    LASSERT_TYPE(a, "drop", 1, LVAL_QEXPR);
+
+    long n = lval_to_num(a->cell[0]);
+    lval *l = a->cell[1];
+    if (n < 0 || n > l->count) { return lval_err_tail_empty(); }
+
+    return lval_slice(lval_take(a, 1), n, l->count - n);
+}
+
+lval *builtin_elem(lenv *e, lval *a) {
+    LASSERT_NUM(a, "elem", 2);
+    LASSERT_TYPE(a, "elem", 1, LVAL_QEXPR);
+
+    // The prelude answers with whatever 'true' and 'false' are bound to
+    lval *r = NULL;
+    gc_root(&a);
+    for (int i = 0; i < a->cell[1]->count && !r; i++) {
+        lval *v = lval_fst(e, a->cell[1]->cell[i]);
+        if (lval_type(v) == LVAL_ERR) { r = v; }
+        else if (lval_eq(a->cell[0], v)) { r = lenv_get(e, lval_sym("true")); }
+    }
+    gc_unroot(1);
+    return r ? r : lenv_get(e, lval_sym("false"));
+}
+
+lval *builtin_lookup(lenv *e, lval *a) {
+    LASSERT_NUM(a, "lookup", 2);
+    LASSERT_TYPE(a, "lookup", 1, LVAL_QEXPR);
+
+    lval *r = NULL;
+    gc_root(&a);
+    for (int i = 0; i < a->cell[1]->count && !r; i++) {
+        lval *p = lval_fst(e, a->cell[1]->cell[i]);
+        if (lval_type(p) == LVAL_ERR) { r = p; break; }
+        if (lval_type(p) != LVAL_QEXPR) {
+            r = lval_err("Function '%s' passed incorrect type for argument %i. "
+                "Got %s, Expected %s.", "head", 0,
+                ltype_name(lval_type(p)), ltype_name(LVAL_QEXPR));
+            break;
+        }
+        // Both (fst p) and (snd p) need something to take the head of
+        if (p->count < 2) { r = lval_err_head_empty(); break; }
+
+        gc_root(&p);
+        lval *key = lval_fst(e, p->cell[0]);
+        if (lval_type(key) == LVAL_ERR) { r = key; }
+        else if (lval_eq(key, a->cell[0])) { r = lval_fst(e, p->cell[1]); }
+        gc_unroot(1);
+    }
+    gc_unroot(1);
+    return r ? r : lval_err("No Element Found");
+}
+
+lval *builtin_zip(lenv *e, lval *a) {
+    LASSERT_NUM(a, "zip", 2);
+    LASSERT_TYPE(a, "zip", 0, LVAL_QEXPR);
+    LASSERT_TYPE(a, "zip", 1, LVAL_QEXPR);
+
+    lval *xs = a->cell[0];
+    lval *ys = a->cell[1];
+    int n = xs->count < ys->count ? xs->count : ys->count;
+
+    lval *x = lval_qexpr_n(n);
+    for (int i = 0; i < n; i++) {
+        lval *p = lval_qexpr_n(2);
+        p->cell[0] = lval_copy(xs->cell[i]);
+        p->cell[1] = lval_copy(ys->cell[i]);
+        x->cell[i] = p;
+    }
+    lval_del(a);
+    return x;
+}
+
+lval *builtin_unzip(lenv *e, lval *a) {
+    LASSERT_NUM(a, "unzip", 1);
+    LASSERT_TYPE(a, "unzip", 0, LVAL_QEXPR);
+
+    // The first element of each pair goes left, the rest of it right
+    lval *x = lval_qexpr_n(2);
+    x->cell[0] = lval_qexpr();
+    x->cell[1] = lval_qexpr();
+    lval *err = NULL;
+    gc_root(&a); gc_root(&x);
+    for (int i = 0; i < a->cell[0]->count && !err; i++) {
+        lval *p = lval_fst(e, a->cell[0]->cell[i]);
+        if (lval_type(p) == LVAL_ERR) { err = p; break; }
+        if (lval_type(p) != LVAL_QEXPR || p->count == 0) {
+            err = lval_type(p) == LVAL_QEXPR ? lval_err_head_empty()
+                : lval_err("Function '%s' passed incorrect type for argument %i. "
+                    "Got %s, Expected %s.", "head", 0,
+                    ltype_name(lval_type(p)), ltype_name(LVAL_QEXPR));
+            break;
+        }
+        x->cell[0] = lval_add(x->cell[0], lval_copy(p->cell[0]));
+        for (int j = 1; j < p->count; j++) {
+            x->cell[1] = lval_add(x->cell[1], lval_copy(p->cell[j]));
+        }
+        gc_write(x);
+    }
+    gc_unroot(2);
+    return err ? err : x;
+}
+
+/* * * * * * *
+*  VECTORS  *
+* * * * * * */
+// Vectors are the one mutable kind of value: vset and vpush change the
+// vector in place and every reference to it sees the change, so they are
+// O(1) no matter how the vector is shared. Capacity doubles as they grow.
+// None of these evaluate anything, so nothing here needs rooting.
+
+// Make room for n more items in v
+void lval_vec_reserve(lval *v, int n) {
+    if (v->len + n <= v->cap) { return; }
+    int cap = v->cap ? v->cap : 4;
+    while (cap < v->len + n) { cap *= 2; }
+    v->items = pool_array_resize(v->items, v->cap, cap);
+    v->cap = cap;
+}
+
+// Append n items from src to v, sharing them
+void lval_vec_append(lval *v, lval **src, int n) {
+    if (n == 0) { return; }
+    lval_vec_reserve(v, n);
+    memcpy(&v->items[v->len], src, sizeof(lval*) * n);
+    for (int i = 0; i < n; i++) { lval_copy(src[i]); }
+    v->len += n;
+    gc_write(v);
+}
+
+//  builtin_vec() makes a vector of the elements of a Q-Expression
+lval *builtin_vec(lenv *e, lval *a) {
+    LASSERT_NUM(a, "vec", 1);
+    LASSERT_TYPE(a, "vec", 0, LVAL_QEXPR);
+
+    lval *q = a->cell[0];
+    lval *v = lval_vec(q->count);
+    lval_vec_append(v, q->cell, q->count);
+    lval_del(a);
+    return v;
+}
+
+//  builtin_vmake() makes a vector of n copies of a value
+lval *builtin_vmake(lenv *e, lval *a) {
+    LASSERT_NUM(a, "vmake", 2);
+    LASSERT_TYPE(a, "vmake", 0, LVAL_NUM);
+
+    long n = lval_to_num(a->cell[0]);
+    LASSERT(a, n >= 0 && n <= INT_MAX,
+        "Function '%s' passed invalid length %li.", "vmake", n);
+
+    lval *v = lval_vec(n);
+    for (int i = 0; i < n; i++) { v->items[i] = lval_copy(a->cell[1]); }
+    v->len = n;
+    lval_del(a);
+    return v;
+}
+
+//  builtin_vlist() returns the items of a vector as a Q-Expression
+lval *builtin_vlist(lenv *e, lval *a) {
+    LASSERT_NUM(a, "vlist", 1);
+    LASSERT_TYPE(a, "vlist", 0, LVAL_VEC);
+
+    lval *v = a->cell[0];
+    lval *x = lval_qexpr();
+    x->count = v->len;
+    x->cell = pool_array_alloc(x->count);
+    for (int i = 0; i < v->len; i++) { x->cell[i] = lval_copy(v->items[i]); }
+    lval_del(a);
+    return x;
+}
+
+lval *builtin_vlen(lenv *e, lval *a) {
+    LASSERT_NUM(a, "vlen", 1);
+    LASSERT_TYPE(a, "vlen", 0, LVAL_VEC);
+
+    lval *x = lval_num(a->cell[0]->len);
+    lval_del(a);
+    return x;
+}
+
+//  builtin_vget() returns the item at an index
+lval *builtin_vget(lenv *e, lval *a) {
+    LASSERT_NUM(a, "vget", 2);
+    LASSERT_TYPE(a, "vget", 0, LVAL_VEC);
+    LASSERT_TYPE(a, "vget", 1, LVAL_NUM);
+
+    lval *v = a->cell[0];
+    long i = lval_to_num(a->cell[1]);
+    LASSERT_INDEX(a, "vget", v, i, v->len);
+
+    lval *x = lval_copy(v->items[i]);
+    lval_del(a);
+    return x;
+}
+
+//  builtin_vset() replaces the item at an index, returning the vector
+lval *builtin_vset(lenv *e, lval *a) {
+    LASSERT_NUM(a, "vset", 3);
+    LASSERT_TYPE(a, "vset", 0, LVAL_VEC);
+    LASSERT_TYPE(a, "vset", 1, LVAL_NUM);
+
+    lval *v = a->cell[0];
+    long i = lval_to_num(a->cell[1]);
+    LASSERT_INDEX(a, "vset", v, i, v->len);
+
+    lval *old = v->items[i];
+    v->items[i] = lval_pop(a, 2);
+    gc_write(v);
+    lval_del(old);
+    return lval_take(a, 0);
+}
+
+//  builtin_vpush() appends an item, returning the vector
+lval *builtin_vpush(lenv *e, lval *a) {
+    LASSERT_NUM(a, "vpush", 2);
+    LASSERT_TYPE(a, "vpush", 0, LVAL_VEC);
+
+    lval *v = a->cell[0];
+    lval_vec_reserve(v, 1);
+    v->items[v->len++] = lval_pop(a, 1);
+    gc_write(v);
+    return lval_take(a, 0);
+}
+
+//  builtin_vslice() returns a new vector of n items from an index on
+lval *builtin_vslice(lenv *e, lval *a) {
+    LASSERT_NUM(a, "vslice", 3);
+    LASSERT_TYPE(a, "vslice", 0, LVAL_VEC);
+    LASSERT_TYPE(a, "vslice", 1, LVAL_NUM);
+    LASSERT_TYPE(a, "vslice", 2, LVAL_NUM);
+
+    lval *v = a->cell[0];
+    long i = lval_to_num(a->cell[1]);
+    long n = lval_to_num(a->cell[2]);
+    LASSERT_INDEX(a, "vslice", v, i, v->len + 1);
+    LASSERT(a, n >= 0 && n <= v->len - i,
+        "Function '%s' passed length %li, past the end of a vector of length %i.",
+        "vslice", n, v->len);
+
+    lval *x = lval_vec(n);
+    lval_vec_append(x, &v->items[i], n);
+    lval_del(a);
+    return x;
+}
+
+//  builtin_vconcat() returns a new vector of the items of each in turn
+lval *builtin_vconcat(lenv *e, lval *a) {
+    int n = 0;
+    for (int i = 0; i < a->count; i++) {
+        LASSERT_TYPE(a, "vconcat", i, LVAL_VEC);
+        n += a->cell[i]->len;
+    }
+
+    lval *x = lval_vec(n);
+    for (int i = 0; i < a->count; i++) {
+        lval_vec_append(x, a->cell[i]->items, a->cell[i]->len);
+    }
+    lval_del(a);
+    return x;
+}
+
+/* * * * * * * *
+*  HASH MAPS  *
+* * * * * * * */
+// Open addressing with linear probing, key and value side by side in one
+// table of pool memory. Deleting a key leaves lval_tomb in its slot so that
+// probes carry on past it, until the next resize drops them. Like vectors,
+// maps are mutable: hset and hdel change the map every reference sees.
+//
+// Keys are hashed by their structure, consistently with lval_eq. Only values
+// that never change in place can be keys, so vectors and maps cannot.
+//
+// The hash of a long string, or of the cells of a list that has been shared
+// (and so can no longer change, see SHARING), is kept in the value once it
+// has been worked out, marked by GC_HASHED. lval_eq uses it to tell shared
+// values apart without looking inside them.
+
+static inline unsigned long lval_hash_mix(unsigned long h, unsigned long x) {
+    h ^= x + 0x9e3779b97f4a7c15UL + (h << 6) + (h >> 2);
+    return h;
+}
+
+static unsigned long lval_hash_big(int sign, const uint32_t *d, int n) {
+    unsigned long h = lval_hash_mix(LVAL_BIG, sign);
+    for (int i = 0; i < n; i++) { h = lval_hash_mix(h, d[i]); }
+    return h;
+}
+
+unsigned long lval_hash(lval *v) {
+    switch (lval_type(v)) {
+        case LVAL_NUM: return lval_hash_mix(LVAL_NUM, lval_to_num(v));
+        case LVAL_BOOL: return lval_hash_mix(LVAL_BOOL, lval_truth(v));
+        case LVAL_BIG: return lval_hash_big(v->bsign, v->limbs, v->blen);
+        case LVAL_FLT: {
+            // Whole floats hash like the Number or Big Number they equal,
+            // which also puts 0.0 and -0.0 together
+            double x = v->dbl;
+            if (x == floor(x) && x >= -9223372036854775808.0 && x < 9223372036854775808.0) {
+                return lval_hash_mix(LVAL_NUM, (long)x);
+            }
+            if (x == floor(x) && !isinf(x)) {
+                uint32_t d[LDBL_LIMBS];
+                return lval_hash_big(x < 0 ? -1 : 1, d, ldbl_limbs(x, d));
+            }
+            unsigned long bits;
+            memcpy(&bits, &x, sizeof(bits));
+            return lval_hash_mix(LVAL_FLT, bits);
+        }
+        case LVAL_SYM: return lval_hash_mix(LVAL_SYM, lsym_hash_of(lval_to_sym(v)));
+        case LVAL_STR:
+            if (v->gc & GC_INLINE) {
+                return lval_hash_mix(LVAL_STR, lsym_hash_n(v->sso, v->ssolen));
+            }
+            if (!(v->gc & GC_HASHED)) {
+                v->shash = lsym_hash_n(v->str, v->slen);
+                v->gc |= GC_HASHED;
+            }
+            return lval_hash_mix(LVAL_STR, v->shash);
+        case LVAL_SEXPR:
+        case LVAL_QEXPR: {
+            if (v->gc & GC_HASHED) { return lval_hash_mix(v->type, v->hash); }
+            unsigned long h = v->count;
+            for (int i = 0; i < v->count; i++) {
+                h = lval_hash_mix(h, lval_hash(v->cell[i]));
+            }
+            // Until it is shared the list may still change
+            if (v->gc & GC_SHARED) {
+                v->hash = h;
+                v->gc |= GC_HASHED;
+            }
+            return lval_hash_mix(v->type, (unsigned)h);
+        }
+    }
+    return 0;
+}
+
+// Whether v can be a key: it and everything in it can never change
+int lval_hashable(lval *v) {
+    switch (lval_type(v)) {
+        case LVAL_NUM: case LVAL_BOOL: case LVAL_SYM: case LVAL_STR:
+        case LVAL_BIG: case LVAL_FLT:
+            return 1;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for (int i = 0; i < v->count; i++) {
+                if (!lval_hashable(v->cell[i])) { return 0; }
+            }
+            return 1;
+    }
+    return 0;
+}
+
+// Slot holding key k with hash h, or -1
+int lval_map_find(lval *m, lval *k, unsigned long h) {
+    for (int i = h & m->mask;; i = (i + 1) & m->mask) {
+        lval *x = m->table[2*i];
+        if (!x) { return -1; }
+        if (x != lval_tomb && lval_eq(x, k)) { return i; }
+    }
+}
+
+// Re-insert every live key into a table of the given number of slots
+void lval_map_resize(lval *m, int slots) {
+    lval **old = m->table;
+    int old_slots = m->mask + 1;
+
+    m->table = pool_array_alloc(2 * slots);
+    memset(m->table, 0, sizeof(lval*) * 2 * slots);
+    m->mask = slots - 1;
+    m->filled = m->size;
+
+    for (int i = 0; i < old_slots; i++) {
+        lval *k = old[2*i];
+        if (!k || k == lval_tomb) { continue; }
+        int j = lval_hash(k) & m->mask;
+        while (m->table[2*j]) { j = (j + 1) & m->mask; }
+        m->table[2*j] = k;
+        m->table[2*j+1] = old[2*i+1];
+    }
+    pool_array_free(old, 2 * old_slots);
+}
+
+// Bind k to v in m, taking ownership of both
+void lval_map_put(lval *m, lval *k, lval *v) {
+    unsigned long h = lval_hash(k);
+    int i = lval_map_find(m, k, h);
+    if (i >= 0) {
+        lval *old = m->table[2*i+1];
+        m->table[2*i+1] = v;
+        gc_write(m);
+        lval_del(old);
+        lval_del(k);
+        return;
+    }
+
+    // Keep slots in use, tombstones included, under three quarters
+    int slots = m->mask + 1;
+    if ((m->filled + 1) * 4 > slots * 3) {
+        while ((m->size + 1) * 2 > slots) { slots *= 2; }
+        lval_map_resize(m, slots);
+    }
+
+    // Reuse the first tombstone on the way to an empty slot
+    i = h & m->mask;
+    while (m->table[2*i] && m->table[2*i] != lval_tomb) { i = (i + 1) & m->mask; }
+    if (!m->table[2*i]) { m->filled++; }
+    m->table[2*i] = k;
+    m->table[2*i+1] = v;
+    m->size++;
+    gc_write(m);
+}
+
+void lval_map_remove(lval *m, lval *k) {
+    int i = lval_map_find(m, k, lval_hash(k));
+    if (i < 0) { return; }
+    lval *ok = m->table[2*i];
+    lval *ov = m->table[2*i+1];
+    m->table[2*i] = lval_tomb;
+    m->table[2*i+1] = NULL;
+    m->size--;
+    lval_del(ok);
+    lval_del(ov);
+}
+
+// A new map with every key of x that is (or is not) also in y
+lval *lval_map_filter(lval *x, lval *y, int in) {
+    lval *m = lval_map(8);
+    for (int i = 0; i <= x->mask; i++) {
+        lval *k = x->table[2*i];
+        if (!k || k == lval_tomb) { continue; }
+        if ((lval_map_find(y, k, lval_hash(k)) >= 0) == in) {
+            lval_map_put(m, lval_copy(k), lval_copy(x->table[2*i+1]));
+        }
+    }
+    return m;
+}
+
+//  builtin_hmap() makes a map from a Q-Expression of {key value} pairs
+lval *builtin_hmap(lenv *e, lval *a) {
+    LASSERT_NUM(a, "hmap", 1);
+    LASSERT_TYPE(a, "hmap", 0, LVAL_QEXPR);
+
+    lval *q = a->cell[0];
+    for (int i = 0; i < q->count; i++) {
+        lval *p = q->cell[i];
+        LASSERT(a, lval_type(p) == LVAL_QEXPR && p->count == 2,
+            "Function '%s' passed %s for a pair, Expected a Q-Expression of 2.",
+            "hmap", ltype_name(lval_type(p)));
+        LASSERT(a, lval_hashable(p->cell[0]),
+            "Function '%s' passed an unhashable key of type %s.",
+            "hmap", ltype_name(lval_type(p->cell[0])));
+    }
+
+    lval *m = lval_map(8);
+    for (int i = 0; i < q->count; i++) {
+        lval *p = q->cell[i];
+        lval_map_put(m, lval_copy(p->cell[0]), lval_copy(p->cell[1]));
+    }
+    lval_del(a);
+    return m;
+}
+
+//  builtin_hsetof() makes a set, a map from each element to true
+lval *builtin_hsetof(lenv *e, lval *a) {
+    LASSERT_NUM(a, "hset-of", 1);
+    LASSERT_TYPE(a, "hset-of", 0, LVAL_QEXPR);
+
+    lval *q = a->cell[0];
+    for (int i = 0; i < q->count; i++) {
+        LASSERT(a, lval_hashable(q->cell[i]),
+            "Function '%s' passed an unhashable key of type %s.",
+            "hset-of", ltype_name(lval_type(q->cell[i])));
+    }
+
+    lval *m = lval_map(8);
+    for (int i = 0; i < q->count; i++) {
+        lval_map_put(m, lval_copy(q->cell[i]), lval_true);
+    }
+    lval_del(a);
+    return m;
+}
+
+//  builtin_hget() returns the value of a key, or a default if given one
+lval *builtin_hget(lenv *e, lval *a) {
+    LASSERT(a, a->count == 2 || a->count == 3,
+        "Function '%s' passed incorrect number of arguments. Got %i, Expected %i.",
+        "hget", a->count, 2);
+    LASSERT_TYPE(a, "hget", 0, LVAL_MAP);
+    LASSERT_KEY(a, "hget", 1);
+
+    lval *m = a->cell[0];
+    lval *k = a->cell[1];
+    int i = lval_map_find(m, k, lval_hash(k));
+    if (i < 0 && a->count == 3) { return lval_take(a, 2); }
+    LASSERT(a, i >= 0, "Function '%s' passed a key that is not in the map.", "hget");
+
+    lval *x = lval_copy(m->table[2*i+1]);
+    lval_del(a);
+    return x;
+}
+
+lval *builtin_hhas(lenv *e, lval *a) {
+    LASSERT_NUM(a, "hhas", 2);
+    LASSERT_TYPE(a, "hhas", 0, LVAL_MAP);
+    LASSERT_KEY(a, "hhas", 1);
+
+    lval *k = a->cell[1];
+    int i = lval_map_find(a->cell[0], k, lval_hash(k));
+    lval_del(a);
+    return lval_bool(i >= 0);
+}
+
+//  builtin_hset() binds a key to a value, returning the map
+lval *builtin_hset(lenv *e, lval *a) {
+    LASSERT_NUM(a, "hset", 3);
+    LASSERT_TYPE(a, "hset", 0, LVAL_MAP);
+    LASSERT_KEY(a, "hset", 1);
+
+    lval *v = lval_pop(a, 2);
+    lval *k = lval_pop(a, 1);
+    lval_map_put(a->cell[0], k, v);
+    return lval_take(a, 0);
+}
+
+//  builtin_hdel() removes a key if it is there, returning the map
+lval *builtin_hdel(lenv *e, lval *a) {
+    LASSERT_NUM(a, "hdel", 2);
+    LASSERT_TYPE(a, "hdel", 0, LVAL_MAP);
+    LASSERT_KEY(a, "hdel", 1);
+
+    lval_map_remove(a->cell[0], a->cell[1]);
+    return lval_take(a, 0);
+}
+
+// The keys (or values) of a map as a Q-Expression, in table order
+lval *lval_map_column(lval *m, int col) {
+    lval *x = lval_qexpr();
+    x->count = m->size;
+    x->cell = pool_array_alloc(x->count);
+    int n = 0;
+    for (int i = 0; i <= m->mask; i++) {
+        lval *k = m->table[2*i];
+        if (!k || k == lval_tomb) { continue; }
+        x->cell[n++] = lval_copy(m->table[2*i+col]);
+    }
+    return x;
+}
+
+lval *builtin_hkeys(lenv *e, lval *a) {
+    LASSERT_NUM(a, "hkeys", 1);
+    LASSERT_TYPE(a, "hkeys", 0, LVAL_MAP);
+
+    lval *x = lval_map_column(a->cell[0], 0);
+    lval_del(a);
+    return x;
+}
+
+lval *builtin_hvals(lenv *e, lval *a) {
+    LASSERT_NUM(a, "hvals", 1);
+    LASSERT_TYPE(a, "hvals", 0, LVAL_MAP);
+
+    lval *x = lval_map_column(a->cell[0], 1);
+    lval_del(a);
+    return x;
+}
+
+lval *builtin_hsize(lenv *e, lval *a) {
+    LASSERT_NUM(a, "hsize", 1);
+    LASSERT_TYPE(a, "hsize", 0, LVAL_MAP);
+
+    lval *x = lval_num(a->cell[0]->size);
+    lval_del(a);
+    return x;
+}
+
+//  builtin_hunion() returns a new map with the keys of both, the second
+//  map's values winning
+lval *builtin_hunion(lenv *e, lval *a) {
+    LASSERT_NUM(a, "hunion", 2);
+    LASSERT_TYPE(a, "hunion", 0, LVAL_MAP);
+    LASSERT_TYPE(a, "hunion", 1, LVAL_MAP);
+
+    lval *x = lval_dup(a->cell[0]);
+    lval *y = a->cell[1];
+    for (int i = 0; i <= y->mask; i++) {
+        lval *k = y->table[2*i];
+        if (!k || k == lval_tomb) { continue; }
+        lval_map_put(x, lval_copy(k), lval_copy(y->table[2*i+1]));
+    }
+    lval_del(a);
+    return x;
+}
+
+//  builtin_hinter() returns a new map with the keys of the first that are
+//  also in the second
+lval *builtin_hinter(lenv *e, lval *a) {
+    LASSERT_NUM(a, "hinter", 2);
+    LASSERT_TYPE(a, "hinter", 0, LVAL_MAP);
+    LASSERT_TYPE(a, "hinter", 1, LVAL_MAP);
+
+    lval *x = lval_map_filter(a->cell[0], a->cell[1], 1);
+    lval_del(a);
+    return x;
+}
+
+//  builtin_hdiff() returns a new map with the keys of the first that are
+//  not in the second
+lval *builtin_hdiff(lenv *e, lval *a) {
+    LASSERT_NUM(a, "hdiff", 2);
+    LASSERT_TYPE(a, "hdiff", 0, LVAL_MAP);
+    LASSERT_TYPE(a, "hdiff", 1, LVAL_MAP);
+
+    lval *x = lval_map_filter(a->cell[0], a->cell[1], 0);
+    lval_del(a);
+    return x;
+}
+
+
+/* * * * * * * * * * *
+*  MEMOISATION  *
+* * * * * * * * * * */
+// memo wraps a function in a builtin_memoised function value, with the
+// wrapped function in formals and a Memo Table in body. Calls are looked up
+// by the structural hash of their argument list, with lval_eq settling
+// collisions, so only arguments that can be Map keys are remembered. The
+// table holds at most cap calls and forgets the least recently used first.
+// Errors are never remembered.
+
+lmemo *lmemo_new(int cap) {
+    lmemo *m = calloc(1, sizeof(lmemo));
+    m->cap = cap;
+    int buckets = 16;
+    while (buckets < cap * 2) { buckets *= 2; }
+    m->mask = buckets - 1;
+    m->buckets = malloc(sizeof(int) * buckets);
+    for (int i = 0; i < buckets; i++) { m->buckets[i] = -1; }
+    m->entries = malloc(sizeof(lmemo_entry) * cap);
+    m->newest = m->oldest = -1;
+    return m;
+}
+
+// Free the table itself, its calls belong to the collector
+void lmemo_del(lmemo *m) {
+    free(m->buckets);
+    free(m->entries);
+    free(m);
+}
+
+void lmemo_unlink(lmemo *m, int i) {
+    lmemo_entry *x = &m->entries[i];
+    if (x->older >= 0) { m->entries[x->older].newer = x->newer; } else { m->oldest = x->newer; }
+    if (x->newer >= 0) { m->entries[x->newer].older = x->older; } else { m->newest = x->older; }
+}
+
+void lmemo_push(lmemo *m, int i) {
+    lmemo_entry *x = &m->entries[i];
+    x->older = m->newest;
+    x->newer = -1;
+    if (m->newest >= 0) { m->entries[m->newest].newer = i; } else { m->oldest = i; }
+    m->newest = i;
+}
+
+// Entry for args with hash h, or -1
+int lmemo_find(lmemo *m, lval *args, unsigned long h) {
+    for (int i = m->buckets[h & m->mask]; i >= 0; i = m->entries[i].chain) {
+        if (m->entries[i].hash == h && lval_same(m->entries[i].args, args)) { return i; }
+    }
+    return -1;
+}
+
+// Remember that args gave val, taking both, in the owner of table t
+void lmemo_put(lval *t, lval *args, unsigned long h, lval *val) {
+    lmemo *m = t->memo;
+    int i;
+    if (m->count < m->cap) {
+        i = m->count++;
+    } else {
+        // Reuse the least recently used entry, taking it out of its bucket
+        i = m->oldest;
+        lmemo_entry *x = &m->entries[i];
+        int *p = &m->buckets[x->hash & m->mask];
+        while (*p != i) { p = &m->entries[*p].chain; }
+        *p = x->chain;
+        lmemo_unlink(m, i);
+        lval_del(x->args);
+        lval_del(x->val);
+        m->evictions++;
+    }
+
+    lmemo_entry *x = &m->entries[i];
+    x->hash = h;
+    x->args = args;
+    x->val = val;
+    x->chain = m->buckets[h & m->mask];
+    m->buckets[h & m->mask] = i;
+    lmemo_push(m, i);
+    gc_write(t);
+}
+
+// Call memoised function f with the arguments a
+lval *lval_memo_call(lenv *e, lval *f, lval *a) {
+    lval *fn = lval_copy(f->formals);
+    lval *t = lval_copy(f->body);
+    lval_del(f);
+
+    lmemo *m = t->memo;
+    if (!lval_hashable(a)) {
+        m->misses++;
+        lval_del(t);
+        return lval_call(e, fn, a);
+    }
+
+    unsigned long h = lval_hash(a);
+    int i = lmemo_find(m, a, h);
+    if (i >= 0) {
+        m->hits++;
+        lmemo_unlink(m, i);
+        lmemo_push(m, i);
+        lval *x = lval_copy(m->entries[i].val);
+        lval_del(a);
+        lval_del(t);
+        return x;
+    }
+
+    // The call may collect, and may reenter this table
+    m->misses++;
+    lval *args = lval_copy(a);
+    gc_root(&args);
+    gc_root(&t);
+    lval *x = lval_call(e, fn, a);
+    gc_unroot(2);
+
+    if (lval_type(x) == LVAL_ERR) {
+        lval_del(args);
+    } else {
+        // Someone else may have remembered this call meanwhile
+        if (lmemo_find(t->memo, args, h) < 0) {
+            lmemo_put(t, args, h, lval_copy(x));
+        } else {
+            lval_del(args);
+        }
+    }
+    lval_del(t);
+    return x;
+}
+
+// Stands for a memoised function, lval_call never calls it
+lval *builtin_memoised(lenv *e, lval *a) {
+    lval_del(a);
+    return lval_err("Memoised function called without its cache.");
+}
+
+//  builtin_memo() wraps a function so that it remembers its most recent
+//  calls, MEMO_DEFAULT_CAP of them unless given a capacity
+lval *builtin_memo(lenv *e, lval *a) {
+    LASSERT(a, a->count == 1 || a->count == 2,
+        "Function '%s' passed incorrect number of arguments. Got %i, Expected %i.",
+        "memo", a->count, 1);
+    LASSERT_TYPE(a, "memo", 0, LVAL_FUN);
+    long cap = MEMO_DEFAULT_CAP;
+    if (a->count == 2) {
+        LASSERT_TYPE(a, "memo", 1, LVAL_NUM);
+        cap = lval_to_num(a->cell[1]);
+        LASSERT(a, cap > 0 && cap <= INT_MAX / 2,
+            "Function '%s' passed invalid capacity %li.", "memo", cap);
+    }
+
+    lval *t = lval_alloc(LVAL_MEMO);
+    t->memo = lmemo_new(cap);
+
+    lval *f = lval_fun(builtin_memoised);
+    f->formals = lval_pop(a, 0);
+    f->body = t;
+    lval_del(a);
+    return f;
+}
+
+//  builtin_memostats() returns {hits misses evictions size capacity} of a
+//  memoised function as {name value} pairs
+lval *builtin_memostats(lenv *e, lval *a) {
+    LASSERT_NUM(a, "memo-stats", 1);
+    LASSERT(a, lval_type(a->cell[0]) == LVAL_FUN
+        && a->cell[0]->builtin == builtin_memoised,
+        "Function '%s' passed a function that is not memoised.", "memo-stats");
+
+    lmemo *m = a->cell[0]->body->memo;
+    lval *x = lval_qexpr();
+    x = lval_add(x, gc_stat("hits", m->hits));
+    x = lval_add(x, gc_stat("misses", m->misses));
+    x = lval_add(x, gc_stat("evictions", m->evictions));
+    x = lval_add(x, gc_stat("size", m->count));
+    x = lval_add(x, gc_stat("capacity", m->cap));
+    lval_del(a);
+    return x;
+}
+
+
+/* * * * * * * *
+*  BIGNUMS  *
+* * * * * * * */
+// Integers that do not fit in a long are Big Numbers: a sign and a
+// magnitude of 32 bit limbs, least significant first. Arithmetic stays on
+// longs, checked for overflow, until a result no longer fits; results that
+// fit again are turned back into plain Numbers, so a Big Number is never
+// equal to a Number. Multiplication of two large magnitudes uses Karatsuba.
+
+#ifdef __GNUC__
+#define lnum_add_overflow __builtin_add_overflow
+#define lnum_sub_overflow __builtin_sub_overflow
+#define lnum_mul_overflow __builtin_mul_overflow
+#else
+static inline int lnum_add_overflow(long x, long y, long *r) {
+    if ((y > 0 && x > LONG_MAX - y) || (y < 0 && x < LONG_MIN - y)) { return 1; }
+    *r = x + y;
+    return 0;
+}
+
+static inline int lnum_sub_overflow(long x, long y, long *r) {
+    if ((y < 0 && x > LONG_MAX + y) || (y > 0 && x < LONG_MIN + y)) { return 1; }
+    *r = x - y;
+    return 0;
+}
+
+static inline int lnum_mul_overflow(long x, long y, long *r) {
+    if (x && y && (x == -1 ? y == LONG_MIN : y == -1 ? x == LONG_MIN
+                   : (x > 0) == (y > 0) ? labs(x) > LONG_MAX / labs(y)
+                   : (x > 0 ? x > LONG_MIN / y : y > LONG_MIN / x))) {
+        return 1;
+    }
+    *r = x * y;
+    return 0;
+}
+#endif
+
+// x op y on longs into *r, or 1 if the result does not fit in a long
+static inline int lnum_op(char op, long x, long y, long *r) {
+    switch (op) {
+        case '+': return lnum_add_overflow(x, y, r);
+        case '-': return lnum_sub_overflow(x, y, r);
+        case '*': return lnum_mul_overflow(x, y, r);
+        case '/':
+            if (x == LONG_MIN && y == -1) { return 1; }
+            *r = x / y;
+            return 0;
+        case '%':
+            *r = y == -1 ? 0 : x % y;
+            return 0;
+    }
+    return 1;
+}
+
+// Sign and magnitude of a Number or Big Number, without copying limbs
+typedef struct {
+    int sign;
+    int n;
+    uint32_t *d;
+    uint32_t small[2];
+} lbig;
+
+void lbig_of(lbig *b, lval *v) {
+    if (lval_type(v) == LVAL_BIG) {
+        b->sign = v->bsign;
+        b->n = v->blen;
+        b->d = v->limbs;
+        return;
+    }
+    long x = lval_to_num(v);
+    uint64_t m = x < 0 ? 0 - (uint64_t)x : (uint64_t)x;
+    b->sign = x < 0 ? -1 : 1;
+    b->small[0] = (uint32_t)m;
+    b->small[1] = (uint32_t)(m >> 32);
+    b->n = b->small[1] ? 2 : b->small[0] ? 1 : 0;
+    b->d = b->small;
+}
+
+int mag_trim(const uint32_t *a, int n) {
+    while (n && !a[n-1]) { n--; }
+    return n;
+}
 
-    // Delete all elements that are not head and return
-    while (v->count > 1) { lval_del(lval_pop(v, 1)); }
-    return v;
+int mag_cmp(const uint32_t *a, int an, const uint32_t *b, int bn) {
+    an = mag_trim(a, an);
+    bn = mag_trim(b, bn);
+    if (an != bn) { return an < bn ? -1 : 1; }
+    for (int i = an - 1; i >= 0; i--) {
+        if (a[i] != b[i]) { return a[i] < b[i] ? -1 : 1; }
+    }
+    return 0;
 }
 
-//  builtin_tail() deletes first element, returns rest
-lval *builtin_tail(lenv *e, lval *a) {
-    // Check error conditions
-    LASSERT_NUM(a, "tail", 1);
-    LASSERT_TYPE(a, "tail", 0, LVAL_QEXPR);
-    LASSERT_NOT_EMPTY(a, "tail", 0);
+// r = a + b, with room in r for max(an, bn) + 1 limbs. Returns that count
+int mag_add(uint32_t *r, const uint32_t *a, int an, const uint32_t *b, int bn) {
+    if (an < bn) {
+        const uint32_t *t = a; a = b; b = t;
+        int tn = an; an = bn; bn = tn;
+    }
+    uint64_t carry = 0;
+    for (int i = 0; i < an; i++) {
+        carry += (uint64_t)a[i] + (i < bn ? b[i] : 0);
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    r[an] = (uint32_t)carry;
+    return an + 1;
+}
 
-    // Take first argument
-    lval *v = lval_take(a, 0);
+// r = a - b for a >= b, with room in r for an limbs
+void mag_sub(uint32_t *r, const uint32_t *a, int an, const uint32_t *b, int bn) {
+    int64_t borrow = 0;
+    for (int i = 0; i < an; i++) {
+        int64_t t = (int64_t)a[i] - (i < bn ? b[i] : 0) - borrow;
+        borrow = t < 0;
+        r[i] = (uint32_t)(t + (borrow << 32));
+    }
+}
 
-    // Delete first element and return
-    lval_del(lval_pop(v, 0));
-    return v;
+// r += a, carrying as far up r as needed
+void mag_add_into(uint32_t *r, int rn, const uint32_t *a, int an) {
+    uint64_t carry = 0;
+    for (int i = 0; i < rn && (i < an || carry); i++) {
+        carry += (uint64_t)r[i] + (i < an ? a[i] : 0);
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
 }
 
-//  builtin_init() returns all of a Q-Expression except the final element
-lval *builtin_init(lenv *e, lval *a) {
-    LASSERT_NUM(a, "init",  1);
-    LASSERT_TYPE(a, "init", 0, LVAL_QEXPR);
-    LASSERT_NOT_EMPTY(a, "init", 0);
+// r -= a, where r >= a
+void mag_sub_into(uint32_t *r, int rn, const uint32_t *a, int an) {
+    int64_t borrow = 0;
+    for (int i = 0; i < rn && (i < an || borrow); i++) {
+        int64_t t = (int64_t)r[i] - (i < an ? a[i] : 0) - borrow;
+        borrow = t < 0;
+        r[i] = (uint32_t)(t + (borrow << 32));
+    }
+}
 
-    lval *v = lval_take(a, 0);
+// r = a * b, r has an + bn limbs and overlaps neither
+void mag_mul(uint32_t *r, const uint32_t *a, int an, const uint32_t *b, int bn) {
+    if (an < bn) {
+        const uint32_t *t = a; a = b; b = t;
+        int tn = an; an = bn; bn = tn;
+    }
 
-    lval_pop(v, v->count - 1);
-    return v;
+    // Schoolbook for small operands
+    if (bn < BIG_KARATSUBA_MIN) {
+        memset(r, 0, sizeof(uint32_t) * (an + bn));
+        for (int j = 0; j < bn; j++) {
+            uint64_t carry = 0;
+            for (int i = 0; i < an; i++) {
+                carry += (uint64_t)a[i] * b[j] + r[i+j];
+                r[i+j] = (uint32_t)carry;
+                carry >>= 32;
+            }
+            r[an+j] = (uint32_t)carry;
+        }
+        return;
+    }
+
+    // Split a in halves a1 a0 at m limbs, and b the same way
+    int m = (an + 1) / 2;
+
+    // b fits in the low half: a * b = a1 * b << m + a0 * b
+    if (bn <= m) {
+        uint32_t *hi = malloc(sizeof(uint32_t) * (an - m + bn));
+        mag_mul(r, a, m, b, bn);
+        memset(r + m + bn, 0, sizeof(uint32_t) * (an - m));
+        mag_mul(hi, a + m, an - m, b, bn);
+        mag_add_into(r + m, an + bn - m, hi, an - m + bn);
+        free(hi);
+        return;
+    }
+
+    // z0 = a0 * b0 and z2 = a1 * b1 fill r between them
+    mag_mul(r, a, m, b, m);
+    mag_mul(r + 2*m, a + m, an - m, b + m, bn - m);
+
+    // z1 = (a0 + a1) * (b0 + b1) - z0 - z2, added in at m limbs
+    uint32_t *sa = malloc(sizeof(uint32_t) * (m + 1));
+    uint32_t *sb = malloc(sizeof(uint32_t) * (m + 1));
+    int san = mag_trim(sa, mag_add(sa, a, m, a + m, an - m));
+    int sbn = mag_trim(sb, mag_add(sb, b, m, b + m, bn - m));
+    uint32_t *z1 = malloc(sizeof(uint32_t) * (san + sbn + 1));
+    mag_mul(z1, sa, san, sb, sbn);
+    int z1n = san + sbn;
+    mag_sub_into(z1, z1n, r, 2*m);
+    mag_sub_into(z1, z1n, r + 2*m, an + bn - 2*m);
+    mag_add_into(r + m, an + bn - m, z1, mag_trim(z1, z1n));
+    free(sa);
+    free(sb);
+    free(z1);
 }
 
-//  builtin_list() turns things into a list S-Expression
-lval *builtin_list(lenv *e, lval *a) {
-    a->type = LVAL_QEXPR;
-    return a;
+// a = a / d in place, returning a % d
+uint32_t mag_div_small(uint32_t *a, int an, uint32_t d) {
+    uint64_t rem = 0;
+    for (int i = an - 1; i >= 0; i--) {
+        uint64_t cur = (rem << 32) | a[i];
+        a[i] = (uint32_t)(cur / d);
+        rem = cur % d;
+    }
+    return (uint32_t)rem;
 }
 
-// builtin_join() joins 2+ Q-Expressions
-lval *builtin_join(lenv *e, lval *a) {
-    // Make sure args are strings or qexprs, and all the same type.
-    int t = a->cell[0]->type;
-    for (int i = 0; i < a->count; i++) {
-        if (a->cell[i]->type != LVAL_QEXPR && a->cell[i]->type != LVAL_STR) {
-            lval_del(a);
-            return lval_err("'Join' needs a string or a Q-expression. "
-                "Got %s", ltype_name(a->cell[i]->type));
-        } else if (a->cell[i]->type != t) {
-            lval_del(a);
-            return lval_err("'Join' needs all args to be the same type. "
-                "Got %s and %s, for example.", ltype_name(t),
-                ltype_name(a->cell[i]->type));
-        }
+// a = a * m + c in place, with room for one more limb. Returns the count
+int mag_muladd_small(uint32_t *a, int an, uint32_t m, uint32_t c) {
+    uint64_t carry = c;
+    for (int i = 0; i < an; i++) {
+        carry += (uint64_t)a[i] * m;
+        a[i] = (uint32_t)carry;
+        carry >>= 32;
     }
+    if (carry) { a[an++] = (uint32_t)carry; }
+    return an;
+}
 
-    lval *x = lval_pop(a, 0);
+static inline int mag_clz(uint32_t x) {
+    int n = 0;
+    while (!(x & 0x80000000u)) { x <<= 1; n++; }
+    return n;
+}
 
-    while (a->count) {
-        x = lval_join(x, lval_pop(a, 0));
+// q = a / b and r = a % b, for a >= b with b trimmed. q has an - bn + 1
+// limbs and r has bn. Knuth's algorithm D
+void mag_divmod(uint32_t *q, uint32_t *r, const uint32_t *a, int an,
+                const uint32_t *b, int bn) {
+    if (bn == 1) {
+        memcpy(q, a, sizeof(uint32_t) * an);
+        r[0] = mag_div_small(q, an, b[0]);
+        return;
     }
 
-    lval_del(a);
-    return x;
+    // Normalise so the top limb of b has its high bit set
+    int s = mag_clz(b[bn-1]);
+    uint32_t *vn = malloc(sizeof(uint32_t) * bn);
+    uint32_t *un = malloc(sizeof(uint32_t) * (an + 1));
+    for (int i = bn - 1; i > 0; i--) {
+        vn[i] = (b[i] << s) | (uint32_t)((uint64_t)b[i-1] >> (32 - s));
+    }
+    vn[0] = b[0] << s;
+    un[an] = (uint32_t)((uint64_t)a[an-1] >> (32 - s));
+    for (int i = an - 1; i > 0; i--) {
+        un[i] = (a[i] << s) | (uint32_t)((uint64_t)a[i-1] >> (32 - s));
+    }
+    un[0] = a[0] << s;
+
+    for (int j = an - bn; j >= 0; j--) {
+        // Estimate the quotient digit from the top two limbs
+        uint64_t num = ((uint64_t)un[j+bn] << 32) | un[j+bn-1];
+        uint64_t qhat = num / vn[bn-1];
+        uint64_t rhat = num % vn[bn-1];
+        while (qhat >> 32
+               || qhat * vn[bn-2] > ((rhat << 32) | un[j+bn-2])) {
+            qhat--;
+            rhat += vn[bn-1];
+            if (rhat >> 32) { break; }
+        }
+
+        // Multiply and subtract
+        int64_t k = 0;
+        int64_t t;
+        for (int i = 0; i < bn; i++) {
+            uint64_t p = qhat * vn[i];
+            t = (int64_t)un[i+j] - k - (int64_t)(p & 0xFFFFFFFFu);
+            un[i+j] = (uint32_t)t;
+            k = (int64_t)(p >> 32) - (t >> 32);
+        }
+        t = (int64_t)un[j+bn] - k;
+        un[j+bn] = (uint32_t)t;
+
+        // Subtracted too much, add one b back
+        q[j] = (uint32_t)qhat;
+        if (t < 0) {
+            q[j]--;
+            uint64_t c = 0;
+            for (int i = 0; i < bn; i++) {
+                c += (uint64_t)un[i+j] + vn[i];
+                un[i+j] = (uint32_t)c;
+                c >>= 32;
+            }
+            un[j+bn] += (uint32_t)c;
+        }
+    }
+
+    // Unnormalise the remainder
+    for (int i = 0; i < bn; i++) {
+        r[i] = (un[i] >> s) | (uint32_t)((uint64_t)un[i+1] << (32 - s));
+    }
+    free(vn);
+    free(un);
 }
 
-// builtin_cons() takes a value and a Q-Expression and
-// appends the value to the front of the Q-Expression
-lval *builtin_cons(lenv *e, lval *a) {
-    LASSERT_NUM(a, "cons", 2);
-    LASSERT_TYPE(a, "cons", 0, LVAL_NUM);
-    LASSERT_TYPE(a, "cons", 1, LVAL_QEXPR);
-    // New Q-Expression
-    lval *newQ = lval_qexpr();
-    newQ = lval_add(newQ, lval_pop(a, 0));
-    lval *oldQ = lval_take(a, 0);
-    newQ = lval_join(newQ, oldQ);
+// A Number or Big Number for sign and the n limbs at d, which it takes
+lval *lval_big(int sign, uint32_t *d, int n) {
+    n = mag_trim(d, n);
+    if (n <= 2) {
+        uint64_t m = n == 0 ? 0 : n == 1 ? d[0] : ((uint64_t)d[1] << 32) | d[0];
+        if (sign > 0 && m <= (uint64_t)LONG_MAX) {
+            free(d);
+            return lval_num((long)m);
+        }
+        if (sign < 0 && m <= (uint64_t)LONG_MAX + 1) {
+            free(d);
+            return lval_num(-(long)(m - 1) - 1);
+        }
+    }
 
-    return newQ;
+    lval *v = lval_alloc(LVAL_BIG);
+    v->bsign = sign;
+    v->blen = n;
+    v->limbs = d;
+    return v;
 }
 
-//  builtin_eval() evaluates contents of a Q-Expression
-lval *builtin_eval(lenv *e, lval *a) {
-    LASSERT_NUM(a, "eval", 1);
-    LASSERT_TYPE(a, "eval", 0, LVAL_QEXPR);
-    lval *x = lval_take(a, 0);
-    x->type = LVAL_SEXPR;
-    return lval_eval(e, x);
+// x op y for Numbers or Big Numbers, taking ownership of x
+lval *lval_big_op(char op, lval *xv, lval *yv) {
+    lbig x, y;
+    lbig_of(&x, xv);
+    lbig_of(&y, yv);
+
+    uint32_t *d = NULL;
+    int n = 0;
+    int sign = 1;
+    switch (op) {
+        case '-':
+            y.sign = -y.sign;
+            /* fall through */
+        case '+':
+            n = (x.n > y.n ? x.n : y.n) + 1;
+            d = malloc(sizeof(uint32_t) * n);
+            if (x.sign == y.sign) {
+                mag_add(d, x.d, x.n, y.d, y.n);
+                sign = x.sign;
+            } else if (mag_cmp(x.d, x.n, y.d, y.n) >= 0) {
+                mag_sub(d, x.d, x.n, y.d, y.n);
+                d[n-1] = 0;
+                sign = x.sign;
+            } else {
+                mag_sub(d, y.d, y.n, x.d, x.n);
+                d[n-1] = 0;
+                sign = y.sign;
+            }
+            break;
+        case '*':
+            n = x.n + y.n;
+            d = malloc(sizeof(uint32_t) * (n ? n : 1));
+            mag_mul(d, x.d, x.n, y.d, y.n);
+            sign = x.sign * y.sign;
+            break;
+        case '/':
+        case '%':
+            if (y.n == 0) {
+                lval_del(xv);
+                return lval_err("Division By Zero!");
+            }
+            if (mag_cmp(x.d, x.n, y.d, y.n) < 0) {
+                // Quotient 0, remainder x
+                n = x.n;
+                d = malloc(sizeof(uint32_t) * (n ? n : 1));
+                if (op == '%') { memcpy(d, x.d, sizeof(uint32_t) * n); } else { n = 0; }
+                sign = x.sign;
+                break;
+            }
+            uint32_t *q = malloc(sizeof(uint32_t) * (x.n - y.n + 1));
+            uint32_t *r = malloc(sizeof(uint32_t) * y.n);
+            mag_divmod(q, r, x.d, x.n, y.d, y.n);
+            if (op == '/') {
+                d = q; n = x.n - y.n + 1; sign = x.sign * y.sign;
+                free(r);
+            } else {
+                d = r; n = y.n; sign = x.sign;
+                free(q);
+            }
+            break;
+    }
+
+    lval_del(xv);
+    return lval_big(sign, d, n);
 }
 
-//  builtin_op() evaluates arithmetical operations
-lval *builtin_op(lenv *e, lval *a, char *op) {
-    // Ensure all arguments are numbers
-    for (int i = 0; i < a->count; i++) {
-        if (a->cell[i]->type != LVAL_NUM) {
-            lval_del(a);
-            return lval_err("Cannot operate on a non-number! "
-            "Got a %s", ltype_name(a->cell[i]->type));
+// A Number, Big Number or Float as the nearest double
+double lval_to_dbl(lval *v) {
+    switch (lval_type(v)) {
+        case LVAL_FLT: return v->dbl;
+        case LVAL_BIG: {
+            double x = 0;
+            for (int i = v->blen - 1; i >= 0; i--) { x = x * 4294967296.0 + v->limbs[i]; }
+            return v->bsign * x;
         }
     }
+    return (double)lval_to_num(v);
+}
 
-    // Pop the first element
-    lval *x = lval_pop(a, 0);
+// The limbs of the magnitude of a whole double into d, which needs room
+// for LDBL_LIMBS. Taking the remainder and dividing by 2^32 are both exact
+int ldbl_limbs(double x, uint32_t *d) {
+    int n = 0;
+    for (x = fabs(x); x > 0; x = floor(x / 4294967296.0)) {
+        d[n++] = (uint32_t)fmod(x, 4294967296.0);
+    }
+    return n;
+}
 
-    // If no arguments and sub then perform unary negation
-    if ((strcmp(op, "-") == 0) && a->count == 0) {
-        x->num = -x->num;
+// -1, 0 or 1 as the Number or Big Number v is less than, equal to or
+// greater than f. Turning v into a double could round it onto f, so this
+// compares v against the whole part of f instead. NaN is never less or more
+int lnum_cmp_dbl(lval *v, double f) {
+    if (f != f) { return 0; }
+    if (isinf(f)) { return f > 0 ? -1 : 1; }
+
+    // Numbers up to 2^53 convert exactly
+    if (lval_type(v) == LVAL_NUM) {
+        long a = lval_to_num(v);
+        if (a > -(1L << 53) && a < (1L << 53)) { return ((double)a > f) - ((double)a < f); }
     }
 
-    // While there are still elements remaining
-    while (a->count > 0) {
+    double w = floor(f);
+    uint32_t d[LDBL_LIMBS] = {0};
+    int n = ldbl_limbs(w, d);
+    lbig b;
+    lbig_of(&b, v);
+    int bs = b.n ? b.sign : 0;
+    int ws = n ? (w < 0 ? -1 : 1) : 0;
+    if (bs != ws) { return bs < ws ? -1 : 1; }
+    int c = mag_cmp(b.d, b.n, d, n);
+    if (bs < 0) { c = -c; }
+    if (c) { return c; }
+    return f > w ? -1 : 0;
+}
+
+// -1, 0 or 1 as x is less than, equal to or greater than y
+int lval_num_cmp(lval *x, lval *y) {
+    if (lval_type(x) == LVAL_NUM && lval_type(y) == LVAL_NUM) {
+        long a = lval_to_num(x);
+        long b = lval_to_num(y);
+        return (a > b) - (a < b);
+    }
+    if (lval_type(x) == LVAL_FLT && lval_type(y) == LVAL_FLT) {
+        return (x->dbl > y->dbl) - (x->dbl < y->dbl);
+    }
+    if (lval_type(x) == LVAL_FLT) { return -lnum_cmp_dbl(y, x->dbl); }
+    if (lval_type(y) == LVAL_FLT) { return lnum_cmp_dbl(x, y->dbl); }
+
+    lbig bx, by;
+    lbig_of(&bx, x);
+    lbig_of(&by, y);
+    if (bx.sign != by.sign) { return bx.sign; }
+    int c = mag_cmp(bx.d, bx.n, by.d, by.n);
+    return bx.sign > 0 ? c : -c;
+}
 
-        // Pop the next element
-        lval *y = lval_pop(a, 0);
+// Read a decimal literal too long for a long
+lval *lval_big_read(char *s) {
+    int sign = 1;
+    if (*s == '-') { sign = -1; s++; }
+
+    // Each limb holds more than 9 digits, and digits go in 9 at a time
+    int len = strlen(s);
+    uint32_t *d = calloc(len / 9 + 2, sizeof(uint32_t));
+    int n = 0;
+    for (int i = 0; i < len; ) {
+        int k = i == 0 && len % 9 ? len % 9 : 9;
+        uint32_t chunk = 0;
+        uint32_t scale = 1;
+        for (int j = 0; j < k; j++) {
+            chunk = chunk * 10 + (s[i+j] - '0');
+            scale *= 10;
+        }
+        n = mag_muladd_small(d, n, scale, chunk);
+        i += k;
+    }
+    return lval_big(sign, d, n);
+}
 
-        if (strcmp(op, "+") == 0) { x->num += y->num; }
-        if (strcmp(op, "-") == 0) { x->num -= y->num; }
-        if (strcmp(op, "*") == 0) { x->num *= y->num; }
-        if (strcmp(op, "%") == 0) { x->num %= y->num; }
-        if (strcmp(op, "/") == 0) {
-            if (y->num == 0) {
-                lval_del(x); lval_del(y);
-                x = lval_err("Division By Zero!"); break;
-            }
-            x->num /= y->num;
+// Decimal digits of a Big Number, malloc'd
+char *lval_big_str(lval *v) {
+    // At most 10 digits per limb, with a sign and a NUL
+    int size = v->blen * 10 + 2;
+    char *s = malloc(size);
+    char *p = s + size - 1;
+    *p = '\0';
+
+    uint32_t *t = malloc(sizeof(uint32_t) * v->blen);
+    memcpy(t, v->limbs, sizeof(uint32_t) * v->blen);
+    int n = v->blen;
+    while (n) {
+        uint32_t chunk = mag_div_small(t, n, 1000000000u);
+        n = mag_trim(t, n);
+        // Every chunk but the most significant is 9 digits with zeros
+        for (int j = 0; j < 9 && (n || chunk); j++) {
+            *--p = '0' + chunk % 10;
+            chunk /= 10;
         }
+    }
+    free(t);
+
+    if (v->bsign < 0) { *--p = '-'; }
+    memmove(s, p, s + size - p);
+    return s;
+}
+
 
-        lval_del(y);
+/* * * * * * * * * * *
+*  TYPED ARRAYS  *
+* * * * * * * * * * */
+// Arrays hold i64 or f64 elements unboxed in one malloc'd block, so the
+// kernels below stream through memory instead of chasing an lval per
+// element. Arrays never change in place: every operation makes a new one.
+// i64 arithmetic wraps on overflow, as C's does on unsigned integers;
+// convert with farr first when values may not fit. Comparisons give masks,
+// i64 Arrays of 0 and 1, that asum counts.
+//
+// With GCC or Clang the kernels work on ARR_LANES elements at a time with
+// vector extensions, which compile to SSE, AVX or NEON as the target allows.
+// Build with -march=native (or at least -mavx2) for the widest registers.
+// Loads and stores go through memcpy, so the data needs no extra alignment.
+
+// Elements per vector: 256 bit registers need AVX, anything older has 128
+#ifdef __AVX__
+#define ARR_LANES 4
+#else
+#define ARR_LANES 2
+#endif
+
+#ifdef __GNUC__
+typedef int64_t arr_i64v __attribute__((vector_size(8 * ARR_LANES)));
+typedef uint64_t arr_u64v __attribute__((vector_size(8 * ARR_LANES)));
+typedef double arr_f64v __attribute__((vector_size(8 * ARR_LANES)));
+
+// r[i] = x[i] OP y[i], with VT as the vector type of T
+#define ARR_ZIP(VT, T, r, x, y, n, OP) do { \
+    int i_ = 0; \
+    for (; i_ + ARR_LANES <= (n); i_ += ARR_LANES) { \
+        VT a_, b_; \
+        memcpy(&a_, &(x)[i_], sizeof(a_)); \
+        memcpy(&b_, &(y)[i_], sizeof(b_)); \
+        a_ = a_ OP b_; \
+        memcpy(&(r)[i_], &a_, sizeof(a_)); \
+    } \
+    for (; i_ < (n); i_++) { (r)[i_] = (T)((x)[i_] OP (y)[i_]); } \
+} while (0)
+
+// m[i] = x[i] CMP y[i] as 0 or 1. Vector comparisons give -1 for true
+#define ARR_CMP(VT, m, x, y, n, CMP) do { \
+    int i_ = 0; \
+    for (; i_ + ARR_LANES <= (n); i_ += ARR_LANES) { \
+        VT a_, b_; \
+        memcpy(&a_, &(x)[i_], sizeof(a_)); \
+        memcpy(&b_, &(y)[i_], sizeof(b_)); \
+        arr_i64v c_ = -(arr_i64v)(a_ CMP b_); \
+        memcpy(&(m)[i_], &c_, sizeof(c_)); \
+    } \
+    for (; i_ < (n); i_++) { (m)[i_] = (x)[i_] CMP (y)[i_]; } \
+} while (0)
+#else
+#define ARR_ZIP(VT, T, r, x, y, n, OP) \
+    for (int i_ = 0; i_ < (n); i_++) { (r)[i_] = (T)((x)[i_] OP (y)[i_]); }
+#define ARR_CMP(VT, m, x, y, n, CMP) \
+    for (int i_ = 0; i_ < (n); i_++) { (m)[i_] = (x)[i_] CMP (y)[i_]; }
+#endif
+
+// r = x op y elementwise for op one of + - *
+void arr_zip(char op, int kind, void *r, void *x, void *y, int n) {
+    if (kind == ARR_I64) {
+        uint64_t *ri = r, *xi = x, *yi = y;
+        switch (op) {
+            case '+': ARR_ZIP(arr_u64v, uint64_t, ri, xi, yi, n, +); break;
+            case '-': ARR_ZIP(arr_u64v, uint64_t, ri, xi, yi, n, -); break;
+            case '*': ARR_ZIP(arr_u64v, uint64_t, ri, xi, yi, n, *); break;
+        }
+    } else {
+        double *rf = r, *xf = x, *yf = y;
+        switch (op) {
+            case '+': ARR_ZIP(arr_f64v, double, rf, xf, yf, n, +); break;
+            case '-': ARR_ZIP(arr_f64v, double, rf, xf, yf, n, -); break;
+            case '*': ARR_ZIP(arr_f64v, double, rf, xf, yf, n, *); break;
+        }
     }
+}
 
-    lval_del(a); return x;
+// m = x cmp y elementwise as 0 or 1, for cmp one of < > <= >= ==
+void arr_cmp(char *cmp, int kind, int64_t *m, void *x, void *y, int n) {
+    int c = cmp[0] == '=' ? 0 : cmp[0] == '<' ? (cmp[1] ? 2 : 1) : (cmp[1] ? 4 : 3);
+    if (kind == ARR_I64) {
+        int64_t *xi = x, *yi = y;
+        switch (c) {
+            case 0: ARR_CMP(arr_i64v, m, xi, yi, n, ==); break;
+            case 1: ARR_CMP(arr_i64v, m, xi, yi, n, <); break;
+            case 2: ARR_CMP(arr_i64v, m, xi, yi, n, <=); break;
+            case 3: ARR_CMP(arr_i64v, m, xi, yi, n, >); break;
+            case 4: ARR_CMP(arr_i64v, m, xi, yi, n, >=); break;
+        }
+    } else {
+        double *xf = x, *yf = y;
+        switch (c) {
+            case 0: ARR_CMP(arr_f64v, m, xf, yf, n, ==); break;
+            case 1: ARR_CMP(arr_f64v, m, xf, yf, n, <); break;
+            case 2: ARR_CMP(arr_f64v, m, xf, yf, n, <=); break;
+            case 3: ARR_CMP(arr_f64v, m, xf, yf, n, >); break;
+            case 4: ARR_CMP(arr_f64v, m, xf, yf, n, >=); break;
+        }
+    }
 }
 
-lval *builtin_ord (lenv *e, lval *a, char *op) {
-    LASSERT_NUM(a, "<", 2);
-    LASSERT_TYPE(a, "<", 0, LVAL_NUM);
-    LASSERT_TYPE(a, "<", 1, LVAL_NUM);
+// Sum of x[i] * y[i], or of x[i] if y is NULL, wrapping for i64
+uint64_t arr_i64_dot(uint64_t *x, uint64_t *y, int n) {
+    int i = 0;
+    uint64_t s = 0;
+#ifdef __GNUC__
+    arr_u64v acc = {0};
+    for (; i + ARR_LANES <= n; i += ARR_LANES) {
+        arr_u64v a, b;
+        memcpy(&a, &x[i], sizeof(a));
+        if (y) { memcpy(&b, &y[i], sizeof(b)); a *= b; }
+        acc += a;
+    }
+    for (int j = 0; j < ARR_LANES; j++) { s += acc[j]; }
+#endif
+    for (; i < n; i++) { s += y ? x[i] * y[i] : x[i]; }
+    return s;
+}
 
-    bool r;
-    if (strcmp(op, "==") == 0) {
-        r = (a->cell[0]->num == a->cell[1]->num);
+// The same for f64, summing in ARR_LANES interleaved partial sums
+double arr_f64_dot(double *x, double *y, int n) {
+    int i = 0;
+    double s = 0;
+#ifdef __GNUC__
+    arr_f64v acc = {0};
+    for (; i + ARR_LANES <= n; i += ARR_LANES) {
+        arr_f64v a, b;
+        memcpy(&a, &x[i], sizeof(a));
+        if (y) { memcpy(&b, &y[i], sizeof(b)); a *= b; }
+        acc += a;
     }
-    if (strcmp(op, "!=") == 0) {
-        r = (a->cell[0]->num != a->cell[1]->num);
+    for (int j = 0; j < ARR_LANES; j++) { s += acc[j]; }
+#endif
+    for (; i < n; i++) { s += y ? x[i] * y[i] : x[i]; }
+    return s;
+}
+
+// Smallest element of x, or largest if CMP is >, for n > 0. Vector lanes
+// keep their own extreme, picked by a mask of where a beats acc
+#ifdef __GNUC__
+#define ARR_EXTREME(VT, T, x, n, CMP) do { \
+    T r_ = (x)[0]; \
+    int i_ = 0; \
+    if ((n) >= ARR_LANES) { \
+        VT acc_; \
+        memcpy(&acc_, (x), sizeof(acc_)); \
+        for (i_ = ARR_LANES; i_ + ARR_LANES <= (n); i_ += ARR_LANES) { \
+            VT a_; \
+            memcpy(&a_, &(x)[i_], sizeof(a_)); \
+            arr_i64v m_ = a_ CMP acc_; \
+            acc_ = (VT)(((arr_i64v)a_ & m_) | ((arr_i64v)acc_ & ~m_)); \
+        } \
+        for (int j_ = 0; j_ < ARR_LANES; j_++) { \
+            if (acc_[j_] CMP r_) { r_ = acc_[j_]; } \
+        } \
+    } \
+    for (; i_ < (n); i_++) { if ((x)[i_] CMP r_) { r_ = (x)[i_]; } } \
+    return r_; \
+} while (0)
+#else
+#define ARR_EXTREME(VT, T, x, n, CMP) do { \
+    T r_ = (x)[0]; \
+    for (int i_ = 1; i_ < (n); i_++) { if ((x)[i_] CMP r_) { r_ = (x)[i_]; } } \
+    return r_; \
+} while (0)
+#endif
+
+int64_t arr_i64_min(int64_t *x, int n) { ARR_EXTREME(arr_i64v, int64_t, x, n, <); }
+int64_t arr_i64_max(int64_t *x, int n) { ARR_EXTREME(arr_i64v, int64_t, x, n, >); }
+double arr_f64_min(double *x, int n) { ARR_EXTREME(arr_f64v, double, x, n, <); }
+double arr_f64_max(double *x, int n) { ARR_EXTREME(arr_f64v, double, x, n, >); }
+
+// An Array of kind from the items of a Q-Expression or the elements of
+// another Array
+lval *lval_arr_of(lval *a, int kind, char *func) {
+    lval *x = a->cell[0];
+    if (lval_type(x) == LVAL_ARR) {
+        lval *r = lval_arr(kind, x->alen);
+        for (int i = 0; i < x->alen; i++) {
+            if (kind == x->akind) {
+                ((int64_t*)r->adata)[i] = ((int64_t*)x->adata)[i];
+            } else if (kind == ARR_I64) {
+                ((int64_t*)r->adata)[i] = (int64_t)((double*)x->adata)[i];
+            } else {
+                ((double*)r->adata)[i] = (double)((int64_t*)x->adata)[i];
+            }
+        }
+        lval_del(a);
+        return r;
     }
-    if (strcmp(op, "<") == 0) {
-        r = (a->cell[0]->num < a->cell[1]->num);
+
+    LASSERT(a, lval_type(x) == LVAL_QEXPR,
+        "Function '%s' passed incorrect type for argument 0. Got %s, Expected %s.",
+        func, ltype_name(lval_type(x)), ltype_name(LVAL_QEXPR));
+    for (int i = 0; i < x->count; i++) {
+        int t = lval_type(x->cell[i]);
+        LASSERT(a, t == LVAL_NUM || (kind == ARR_F64 && lval_is_number(x->cell[i])),
+            "Function '%s' passed %s at index %i, which does not fit in an Array.",
+            func, ltype_name(t), i);
     }
-    if (strcmp(op, "<=") == 0) {
-        r = (a->cell[0]->num <= a->cell[1]->num);
+
+    lval *r = lval_arr(kind, x->count);
+    for (int i = 0; i < x->count; i++) {
+        if (kind == ARR_I64) {
+            ((int64_t*)r->adata)[i] = lval_to_num(x->cell[i]);
+        } else {
+            ((double*)r->adata)[i] = lval_to_dbl(x->cell[i]);
+        }
     }
-    if (strcmp(op, ">") == 0) {
-        r = (a->cell[0]->num > a->cell[1]->num);
+    lval_del(a);
+    return r;
+}
+
+//  builtin_arr() makes an i64 Array of a Q-Expression of Numbers
+lval *builtin_arr(lenv *e, lval *a) {
+    LASSERT_NUM(a, "arr", 1);
+    return lval_arr_of(a, ARR_I64, "arr");
+}
+
+//  builtin_farr() makes an f64 Array of a Q-Expression of any numbers
+lval *builtin_farr(lenv *e, lval *a) {
+    LASSERT_NUM(a, "farr", 1);
+    return lval_arr_of(a, ARR_F64, "farr");
+}
+
+//  builtin_arange() makes the i64 Array 0 1 ... n-1
+lval *builtin_arange(lenv *e, lval *a) {
+    LASSERT_NUM(a, "arange", 1);
+    LASSERT_TYPE(a, "arange", 0, LVAL_NUM);
+
+    long n = lval_to_num(a->cell[0]);
+    LASSERT(a, n >= 0 && n <= INT_MAX,
+        "Function '%s' passed invalid length %li.", "arange", n);
+
+    lval *r = lval_arr(ARR_I64, n);
+    for (int i = 0; i < n; i++) { ((int64_t*)r->adata)[i] = i; }
+    lval_del(a);
+    return r;
+}
+
+// Element i of an Array as a Number or Float
+lval *lval_arr_get(lval *v, int i) {
+    return v->akind == ARR_I64
+        ? lval_num(((int64_t*)v->adata)[i])
+        : lval_flt(((double*)v->adata)[i]);
+}
+
+//  builtin_alist() returns the elements of an Array as a Q-Expression
+lval *builtin_alist(lenv *e, lval *a) {
+    LASSERT_NUM(a, "alist", 1);
+    LASSERT_TYPE(a, "alist", 0, LVAL_ARR);
+
+    lval *v = a->cell[0];
+    lval *x = lval_qexpr();
+    x->count = v->alen;
+    x->cell = pool_array_alloc(x->count);
+    for (int i = 0; i < v->alen; i++) { x->cell[i] = lval_arr_get(v, i); }
+    lval_del(a);
+    return x;
+}
+
+lval *builtin_alen(lenv *e, lval *a) {
+    LASSERT_NUM(a, "alen", 1);
+    LASSERT_TYPE(a, "alen", 0, LVAL_ARR);
+
+    lval *x = lval_num(a->cell[0]->alen);
+    lval_del(a);
+    return x;
+}
+
+//  builtin_aget() returns the element at an index
+lval *builtin_aget(lenv *e, lval *a) {
+    LASSERT_NUM(a, "aget", 2);
+    LASSERT_TYPE(a, "aget", 0, LVAL_ARR);
+    LASSERT_TYPE(a, "aget", 1, LVAL_NUM);
+
+    lval *v = a->cell[0];
+    long i = lval_to_num(a->cell[1]);
+    LASSERT(a, i >= 0 && i < v->alen,
+        "Function '%s' passed index %li, outside an array of length %i.",
+        "aget", i, v->alen);
+
+    lval *x = lval_arr_get(v, i);
+    lval_del(a);
+    return x;
+}
+
+// Check that a has two Arrays of the same kind and length
+#define LASSERT_ARR_PAIR(args, func) \
+    LASSERT_NUM(args, func, 2); \
+    LASSERT_TYPE(args, func, 0, LVAL_ARR); \
+    LASSERT_TYPE(args, func, 1, LVAL_ARR); \
+    LASSERT(args, args->cell[0]->akind == args->cell[1]->akind, \
+        "Function '%s' passed Arrays of different element types.", func); \
+    LASSERT(args, args->cell[0]->alen == args->cell[1]->alen, \
+        "Function '%s' passed Arrays of lengths %i and %i.", \
+        func, args->cell[0]->alen, args->cell[1]->alen)
+
+lval *builtin_azip(lval *a, char op, char *func) {
+    LASSERT_ARR_PAIR(a, func);
+
+    lval *x = a->cell[0];
+    lval *r = lval_arr(x->akind, x->alen);
+    arr_zip(op, x->akind, r->adata, x->adata, a->cell[1]->adata, x->alen);
+    lval_del(a);
+    return r;
+}
+
+lval *builtin_aadd(lenv *e, lval *a) { return builtin_azip(a, '+', "aadd"); }
+lval *builtin_asub(lenv *e, lval *a) { return builtin_azip(a, '-', "asub"); }
+lval *builtin_amul(lenv *e, lval *a) { return builtin_azip(a, '*', "amul"); }
+
+lval *builtin_acmp(lval *a, char *cmp, char *func) {
+    LASSERT_ARR_PAIR(a, func);
+
+    lval *x = a->cell[0];
+    lval *r = lval_arr(ARR_I64, x->alen);
+    arr_cmp(cmp, x->akind, r->adata, x->adata, a->cell[1]->adata, x->alen);
+    lval_del(a);
+    return r;
+}
+
+lval *builtin_alt(lenv *e, lval *a) { return builtin_acmp(a, "<", "alt"); }
+lval *builtin_agt(lenv *e, lval *a) { return builtin_acmp(a, ">", "agt"); }
+lval *builtin_ale(lenv *e, lval *a) { return builtin_acmp(a, "<=", "ale"); }
+lval *builtin_age(lenv *e, lval *a) { return builtin_acmp(a, ">=", "age"); }
+lval *builtin_aeq(lenv *e, lval *a) { return builtin_acmp(a, "==", "aeq"); }
+
+//  builtin_adot() returns the sum of the elementwise product
+lval *builtin_adot(lenv *e, lval *a) {
+    LASSERT_ARR_PAIR(a, "adot");
+
+    lval *x = a->cell[0];
+    lval *y = a->cell[1];
+    lval *r = x->akind == ARR_I64
+        ? lval_num((int64_t)arr_i64_dot(x->adata, y->adata, x->alen))
+        : lval_flt(arr_f64_dot(x->adata, y->adata, x->alen));
+    lval_del(a);
+    return r;
+}
+
+lval *builtin_asum(lenv *e, lval *a) {
+    LASSERT_NUM(a, "asum", 1);
+    LASSERT_TYPE(a, "asum", 0, LVAL_ARR);
+
+    lval *x = a->cell[0];
+    lval *r = x->akind == ARR_I64
+        ? lval_num((int64_t)arr_i64_dot(x->adata, NULL, x->alen))
+        : lval_flt(arr_f64_dot(x->adata, NULL, x->alen));
+    lval_del(a);
+    return r;
+}
+
+lval *builtin_aextreme(lval *a, int max, char *func) {
+    LASSERT_NUM(a, func, 1);
+    LASSERT_TYPE(a, func, 0, LVAL_ARR);
+    LASSERT(a, a->cell[0]->alen != 0,
+        "Function '%s' passed an empty Array.", func);
+
+    lval *x = a->cell[0];
+    lval *r;
+    if (x->akind == ARR_I64) {
+        r = lval_num(max ? arr_i64_max(x->adata, x->alen) : arr_i64_min(x->adata, x->alen));
+    } else {
+        r = lval_flt(max ? arr_f64_max(x->adata, x->alen) : arr_f64_min(x->adata, x->alen));
     }
-    if (strcmp(op, ">=") == 0) {
-        r = (a->cell[0]->num >= a->cell[1]->num);
+    lval_del(a);
+    return r;
+}
+
+lval *builtin_amin(lenv *e, lval *a) { return builtin_aextreme(a, 0, "amin"); }
+lval *builtin_amax(lenv *e, lval *a) { return builtin_aextreme(a, 1, "amax"); }
+
+
+// Arithmetic on doubles, for when any argument is a Float
+lval *lval_flt_op(lval *a, char op) {
+    double x = lval_to_dbl(a->cell[0]);
+    if (op == '-' && a->count == 1) { x = -x; }
+
+    for (int i = 1; i < a->count; i++) {
+        double y = lval_to_dbl(a->cell[i]);
+        switch (op) {
+            case '+': x += y; break;
+            case '-': x -= y; break;
+            case '*': x *= y; break;
+            case '/':
+            case '%':
+                if (y == 0) {
+                    lval_del(a);
+                    return lval_err("Division By Zero!");
+                }
+                x = op == '/' ? x / y : fmod(x, y);
+                break;
+        }
     }
 
     lval_del(a);
-    return lval_bool(r);
+    return lval_flt(x);
 }
 
-lval *builtin_cmp(lenv *e, lval *a, char *op) {
-    LASSERT_NUM(a, op, 2);
-    bool r;
-    if (strcmp(op, "==") == 0) {
-        r = lval_eq(a->cell[0], a->cell[1]);
+// A builtin arithmetic operator folded over a from argument i on, with x
+// the fold of the arguments before it. This is the general case, for Big
+// Numbers, Floats, unary minus, overflow and bad arguments; each operator's
+// builtin handles plain Numbers itself and comes here for anything else.
+lval *lval_num_op(lval *a, char op, int i, long x) {
+    // Ensure all arguments are numbers
+    LASSERT(a, a->count > 0,
+        "Function '%c' passed no arguments.", op);
+    int flt = 0;
+    for (int j = 0; j < a->count; j++) {
+        LASSERT(a, lval_is_number(a->cell[j]),
+            "Cannot operate on a non-number! "
+            "Got a %s", ltype_name(lval_type(a->cell[j])));
+        flt |= lval_type(a->cell[j]) == LVAL_FLT;
+    }
+
+    // Any Float makes the whole operation Float
+    if (flt) { return lval_flt_op(a, op); }
+
+    // Accumulate directly on the unboxed values while they fit in a long,
+    // and in a Big Number acc from the first result that does not
+    lval *acc = NULL;
+    if (i == 0) {
+        if (lval_type(a->cell[0]) == LVAL_BIG) {
+            acc = lval_copy(a->cell[0]);
+        } else {
+            x = lval_to_num(a->cell[0]);
+        }
+        i = 1;
+
+        // If no arguments and sub then perform unary negation
+        long r;
+        if (op == '-' && a->count == 1) {
+            if (acc || lnum_op('-', 0, x, &r)) {
+                if (acc) { lval_del(acc); }
+                acc = lval_big_op('-', lval_num(0), a->cell[0]);
+            } else {
+                x = r;
+            }
+        }
     }
-    if (strcmp(op, "!=") == 0) {
-        r = !lval_eq(a->cell[0], a->cell[1]);
+
+    for (; i < a->count; i++) {
+        lval *yv = a->cell[i];
+        long y = lval_type(yv) == LVAL_NUM ? lval_to_num(yv) : 1;
+
+        if ((op == '/' || op == '%') && lval_type(yv) == LVAL_NUM && y == 0) {
+            if (acc) { lval_del(acc); }
+            lval_del(a);
+            return lval_err("Division By Zero!");
+        }
+
+        // The first overflow moves x into acc for good
+        if (!acc) {
+            long r;
+            if (lval_type(yv) == LVAL_NUM && !lnum_op(op, x, y, &r)) {
+                x = r;
+                continue;
+            }
+            acc = lval_num(x);
+        }
+
+        acc = lval_big_op(op, acc, yv);
     }
+
+    lval_del(a);
+    return acc ? acc : lval_num(x);
+}
+
+static inline int lnum_div_overflow(long x, long y, long *r) {
+    if (y == 0 || (x == LONG_MIN && y == -1)) { return 1; }
+    *r = x / y;
+    return 0;
+}
+
+// The body of an arithmetic builtin: fold step over the arguments while
+// they are Numbers and nothing overflows, without leaving the cell array
+#define LNUM_FOLD(a, op, step) do { \
+    lval **c_ = (a)->cell; \
+    int n_ = (a)->count; \
+    if (n_ < 2 || lval_type(c_[0]) != LVAL_NUM) { return lval_num_op(a, op, 0, 0); } \
+    long x_ = lval_to_num(c_[0]); \
+    for (int i_ = 1; i_ < n_; i_++) { \
+        long r_; \
+        if (lval_type(c_[i_]) != LVAL_NUM || step(x_, lval_to_num(c_[i_]), &r_)) { \
+            return lval_num_op(a, op, i_, x_); \
+        } \
+        x_ = r_; \
+    } \
+    lval_del(a); \
+    return lval_num(x_); \
+} while (0)
+
+lval *builtin_add(lenv *e, lval *a) { LNUM_FOLD(a, '+', lnum_add_overflow); }
+lval *builtin_sub(lenv *e, lval *a) { LNUM_FOLD(a, '-', lnum_sub_overflow); }
+lval *builtin_mul(lenv *e, lval *a) { LNUM_FOLD(a, '*', lnum_mul_overflow); }
+lval *builtin_div(lenv *e, lval *a) { LNUM_FOLD(a, '/', lnum_div_overflow); }
+
+// The body of an ordering builtin. Fixnums keep their order when compared
+// as tagged words, so two of them need no unboxing
+#define LNUM_ORD(a, name, CMP) do { \
+    LASSERT_NUM(a, name, 2); \
+    lval *x_ = (a)->cell[0]; \
+    lval *y_ = (a)->cell[1]; \
+    if (lval_is_fixnum(x_) && lval_is_fixnum(y_)) { \
+        lval_del(a); \
+        return lval_bool((intptr_t)x_ CMP (intptr_t)y_); \
+    } \
+    LASSERT_NUMBER(a, name, 0); \
+    LASSERT_NUMBER(a, name, 1); \
+    int c_ = lval_num_cmp(x_, y_); \
+    lval_del(a); \
+    return lval_bool(c_ CMP 0); \
+} while (0)
+
+lval *builtin_lt(lenv *e, lval *a) { LNUM_ORD(a, "<", <); }
+lval *builtin_lte(lenv *e, lval *a) { LNUM_ORD(a, "<=", <=); }
+lval *builtin_gt(lenv *e, lval *a) { LNUM_ORD(a, ">", >); }
+lval *builtin_gte(lenv *e, lval *a) { LNUM_ORD(a, ">=", >=); }
+
+// Numbers of different types are equal when their values are, so == agrees
+// with <= and >=. A NaN equals nothing
+lval *builtin_eq(lenv *e, lval *a) {
+    LASSERT_NUM(a, "==", 2);
+    bool r = lval_eq(a->cell[0], a->cell[1]);
+    lval_del(a);
+    return lval_bool(r);
+}
+
+lval *builtin_ne(lenv *e, lval *a) {
+    LASSERT_NUM(a, "!=", 2);
+    bool r = !lval_eq(a->cell[0], a->cell[1]);
     lval_del(a);
     return lval_bool(r);
 }
 
+// Builtin f applied to the fixnums x and y without an argument list, for
+// callers that have not built one yet. NULL if f is not an arithmetic or
+// ordering builtin, or the result needs the full one
+lval *lval_fix_call(lbuiltin f, lval *x, lval *y) {
+    long a = lval_to_num(x);
+    long b = lval_to_num(y);
+    long r;
+    if (f == builtin_add) { return lnum_add_overflow(a, b, &r) ? NULL : lval_num(r); }
+    if (f == builtin_sub) { return lnum_sub_overflow(a, b, &r) ? NULL : lval_num(r); }
+    if (f == builtin_lt) { return lval_bool(a < b); }
+    if (f == builtin_eq) { return lval_bool(a == b); }
+    if (f == builtin_mul) { return lnum_mul_overflow(a, b, &r) ? NULL : lval_num(r); }
+    if (f == builtin_div) { return lnum_div_overflow(a, b, &r) ? NULL : lval_num(r); }
+    if (f == builtin_gt) { return lval_bool(a > b); }
+    if (f == builtin_lte) { return lval_bool(a <= b); }
+    if (f == builtin_gte) { return lval_bool(a >= b); }
+    if (f == builtin_ne) { return lval_bool(a != b); }
+    return NULL;
+}
+
 lval *builtin_if(lenv *e, lval *a){
     LASSERT_NUM(a, "if", 3);
     LASSERT_TYPE(a, "if", 0, LVAL_BOOL);
     LASSERT_TYPE(a, "if", 1, LVAL_QEXPR);
     LASSERT_TYPE(a, "if", 2, LVAL_QEXPR);
 
-    // Mark both expressions as evaluable
-    lval *x;
-    a->cell[1]->type = LVAL_SEXPR;
-    a->cell[2]->type = LVAL_SEXPR;
-
-    if (a->cell[0]->truth_value) {
-        // If condition is true evaluate the first expression
-        x = lval_eval(e, lval_pop(a, 1));
-    } else {
-        // Otherwise evaluate second expression
-        x = lval_eval(e, lval_pop(a, 2));
-    }
-
-    // Delete arg list and return
+    // If condition is true take the first expression, otherwise the second
+    lval *x = lval_mut(lval_pop(a, lval_truth(a->cell[0]) ? 1 : 2));
     lval_del(a);
-    return x;
+
+    // Mark it as evaluable and evaluate
+    x->type = LVAL_SEXPR;
+    return lval_eval(e, x);
 }
 
 lval *builtin_or(lenv *e, lval *a) {
@@ -1036,7 +5129,7 @@ lval *builtin_or(lenv *e, lval *a) {
     LASSERT_TYPE(a, "||", 0, LVAL_NUM)
     LASSERT_TYPE(a, "||", 1, LVAL_NUM)
 
-    if (a->cell[0]->num == 1 || a->cell[1]->num == 1) { return lval_bool(true);}
+    if (lval_to_num(a->cell[0]) == 1 || lval_to_num(a->cell[1]) == 1) { return lval_bool(true);}
     lval_del(a);
     return lval_bool(false);
 }
@@ -1046,7 +5139,7 @@ lval *builtin_and(lenv *e, lval *a) {
     LASSERT_TYPE(a, "&&", 0, LVAL_NUM)
     LASSERT_TYPE(a, "&&", 1, LVAL_NUM)
 
-    if (a->cell[0]->num == 1 && a->cell[1]->num == 1) { return lval_bool(true);}
+    if (lval_to_num(a->cell[0]) == 1 && lval_to_num(a->cell[1]) == 1) { return lval_bool(true);}
     lval_del(a);
     return lval_bool(false);
 }
@@ -1055,7 +5148,7 @@ lval *builtin_not(lenv *e, lval *a) {
     LASSERT_NUM(a, "!", 1)
     LASSERT_TYPE(a, "!", 0, LVAL_NUM)
 
-    if (a->cell[0]->num == 0) {
+    if (lval_to_num(a->cell[0]) == 0) {
         return lval_bool(true);
     } else {
         return lval_bool(false);
@@ -1064,25 +5157,62 @@ lval *builtin_not(lenv *e, lval *a) {
     lval_del(a);
 }
 
-lval *builtin_lt(lenv *e, lval *a) { return builtin_ord(e, a, "<"); }
-lval *builtin_lte(lenv *e, lval *a) { return builtin_ord(e, a, "<="); }
-lval *builtin_gt(lenv *e, lval *a) { return builtin_ord(e, a, ">"); }
-lval *builtin_gte(lenv *e, lval *a) { return builtin_ord(e, a, ">="); }
-
-lval *builtin_eq(lenv *e, lval *a) { return builtin_cmp(e, a, "=="); }
-lval *builtin_ne(lenv *e, lval *a) { return builtin_cmp(e, a, "!="); }
-
-lval *builtin_add(lenv *e, lval *a) { return builtin_op(e, a, "+"); }
-lval *builtin_sub(lenv *e, lval *a) { return builtin_op(e, a, "-"); }
-lval *builtin_mul(lenv *e, lval *a) { return builtin_op(e, a, "*"); }
-lval *builtin_div(lenv *e, lval *a) { return builtin_op(e, a, "/"); }
-
 // TODO: env and exit require an argument at the moment; should not.
 lval *builtin_env(lenv *e, lval *a) {
     lenv_print(e);
     return a;
 }
 
+lval *gc_stat(char *name, long x) {
+    return lval_add(lval_add(lval_qexpr(), lval_sym(name)), lval_num(x));
+}
+
+// Collector statistics as a list of {name value} pairs
+lval *builtin_gc(lenv *e, lval *a) {
+    lval_del(a);
+    lval *x = lval_qexpr();
+    x = lval_add(x, gc_stat("minor", gc_stats.minor));
+    x = lval_add(x, gc_stat("major", gc_stats.major));
+    x = lval_add(x, gc_stat("pause-us", gc_stats.pause_total * 1e6));
+    x = lval_add(x, gc_stat("pause-max-us", gc_stats.pause_max * 1e6));
+    x = lval_add(x, gc_stat("allocated", gc_stats.allocated));
+    x = lval_add(x, gc_stat("promoted", gc_stats.promoted));
+    x = lval_add(x, gc_stat("nursery-bytes",
+        (long)gc_chunks.count * GC_NURSERY_LVALS * sizeof(lval)));
+    x = lval_add(x, gc_stat("old-bytes", (long)gc_old.count * sizeof(lval)));
+    x = lval_add(x, gc_stat("envs", gc_envs.count));
+    return x;
+}
+
+// {name {used n} {free n} {bytes n} {waste n}} for one pool: blocks handed
+// out, blocks idle on the free list, slab bytes held, and bytes lost to
+// rounding arrays up to their class
+lval *pool_stat(char *name, pool *p, long requested) {
+    lval *x = lval_add(lval_qexpr(), lval_sym(name));
+    x = lval_add(x, gc_stat("used", p->used));
+    x = lval_add(x, gc_stat("free", p->blocks - p->used));
+    x = lval_add(x, gc_stat("bytes", p->blocks * (long)p->size));
+    x = lval_add(x, gc_stat("waste", p->used * (long)p->size - requested));
+    return x;
+}
+
+lval *builtin_pools(lenv *e, lval *a) {
+    lval_del(a);
+    lval *x = lval_qexpr();
+    x = lval_add(x, pool_stat("lval", &pool_lval,
+        pool_lval.used * (long)pool_lval.size));
+    x = lval_add(x, pool_stat("lenv", &pool_lenv,
+        pool_lenv.used * (long)pool_lenv.size));
+    for (int c = 0; c < POOL_ARRAY_CLASSES; c++) {
+        pool *p = &pool_arrays[c];
+        if (!p->blocks) { continue; }
+        char name[32];
+        snprintf(name, sizeof(name), "array-%d", 1 << c);
+        x = lval_add(x, pool_stat(name, p, p->requested));
+    }
+    return x;
+}
+
 lval *builtin_exit() {
     exit(0);
 }
@@ -1094,6 +5224,24 @@ lval *builtin_exit() {
 
 int main(int argc, char **argv) {
 
+    // Strip interpreter flags, leaving just the files to load
+    int files = 1;
+    int lang_flags = MPCA_LANG_DEFAULT;
+    for (int i = 1; i < argc; i++) {
+        // Evaluate lambda bodies with the reference tree-walker
+        if (strcmp(argv[i], "--tree-walk") == 0) { vm_enabled = 0; continue; }
+        // Read files with the mpc grammar instead of the reader
+        if (strcmp(argv[i], "--mpc-reader") == 0) { reader_mpc = 1; continue; }
+        // As above, with packrat memoisation of each grammar rule
+        if (strcmp(argv[i], "--mpc-packrat") == 0) {
+            reader_mpc = 1;
+            lang_flags |= MPCA_LANG_PACKRAT;
+            continue;
+        }
+        argv[files++] = argv[i];
+    }
+    argc = files;
+
     // AST Parsers
     String   = mpc_new("string");
     Comment  = mpc_new("comment");
@@ -1104,11 +5252,11 @@ int main(int argc, char **argv) {
     Expr     = mpc_new("expr");
     Rosq     = mpc_new("rosq");
 
-    mpca_lang(MPCA_LANG_DEFAULT,
+    mpca_lang(lang_flags,
         "                                              \
         string  : /\"(\\\\.|[^\"])*\"/ ;               \
         comment : /;[^\\r\\n]*/ ;                      \
-        number  : /-?[0-9]+/ ;                         \
+        number  : /-?[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?/ ; \
         symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>|!&]+/;   \
         sexpr   : '(' <expr>* ')' ;                    \
         qexpr   : '{' <expr>* '}' ;                    \
@@ -1120,7 +5268,11 @@ int main(int argc, char **argv) {
         Sexpr,  Qexpr,   Expr,   Rosq);
 
 
+    lsym_init();
+    pool_init();
+
     lenv *e = lenv_new();
+    gc_root_env(e);
     lenv_add_builtins(e);
 
     if (argc == 1) {
@@ -1129,17 +5281,17 @@ int main(int argc, char **argv) {
 
         while (1) {
             char *input = readline("rosq> ");
+            if (!input) { break; }
             add_history(input);
 
-            mpc_result_t r;
-            if (mpc_parse("<stdin>", input, Rosq, &r)) {
-                lval *x = lval_eval(e, lval_read(r.output));
-                lval_println(x);
+            lval *x = lval_read_src(input, strlen(input), "<stdin>");
+            if (lval_type(x) == LVAL_ERR) {
+                puts(lval_str_ptr(x));
                 lval_del(x);
-                mpc_ast_delete(r.output);
             } else {
-                mpc_err_print(r.error);
-                mpc_err_delete(r.error);
+                x = lval_eval(e, x);
+                lval_println(x);
+                lval_del(x);
             }
 
             free(input);
@@ -1156,11 +5308,21 @@ int main(int argc, char **argv) {
             lval *x = builtin_load(e, args);
 
             // If the result is an error, be sure to print it
-            if (x->type == LVAL_ERR) { lval_println(x); }
+            if (lval_type(x) == LVAL_ERR) { lval_println(x); }
             lval_del(x);
         }
     }
 
+    if (lang_flags & MPCA_LANG_PACKRAT) {
+        mpc_packrat_stats_t st;
+        mpc_packrat_stats(&st);
+        fprintf(stderr, "packrat: %ld lookups, %ld hits (%.1f%%), %ld stores, "
+                "%ld evictions, %ld reclaims\n",
+                st.lookups, st.hits,
+                st.lookups ? 100.0 * st.hits / st.lookups : 0.0,
+                st.stores, st.evictions, st.reclaims);
+    }
+
     lenv_del(e);
     mpc_cleanup(8,
         String, Comment, Number, Symbol,
@@ -1,5 +1,9 @@
 #include "mpc.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
 
 #ifdef _WIN32
 
@@ -25,9 +29,9 @@
 if (!(cond)) { lval* err = lval_err(fmt, ##__VA_ARGS__); lval_del(args); return err; }
 
 #define LASSERT_TYPE(args, func, index, expect) \
-    LASSERT(args, args->cell[index]->type == expect, \
+    LASSERT(args, lval_type(args->cell[index]) == expect, \
         "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
-        func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
+        func, index, ltype_name(lval_type(args->cell[index])), ltype_name(expect))
 
 #define LASSERT_NUM(args, func, num) \
     LASSERT(args, args->count == num, \
@@ -38,12 +42,67 @@ if (!(cond)) { lval* err = lval_err(fmt, ##__VA_ARGS__); lval_del(args); return
     LASSERT(args, args->cell[index]->count != 0, \
         "Function '%s' passed {} for argument %i.", func, index);
 
+#define LASSERT_INDEX(args, func, v, i, max) \
+    LASSERT(args, i >= 0 && i < max, \
+        "Function '%s' passed index %li, outside a vector of length %i.", \
+        func, i, v->len)
+
+#define LASSERT_NUMBER(args, func, index) \
+    LASSERT(args, lval_is_number(args->cell[index]), \
+        "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
+        func, index, ltype_name(lval_type(args->cell[index])), ltype_name(LVAL_NUM))
+
+#define LASSERT_KEY(args, func, index) \
+    LASSERT(args, lval_hashable(args->cell[index]), \
+        "Function '%s' passed an unhashable key of type %s.", \
+        func, ltype_name(lval_type(args->cell[index])))
+
 
 // Forward declare functions
 
 
+// Range of numbers that can be stored unboxed in an lval pointer
+#define LVAL_FIXNUM_MAX (LONG_MAX >> 1)
+#define LVAL_FIXNUM_MIN (LONG_MIN >> 1)
+
+// Strings and errors of up to this many bytes are kept inline
+#define LVAL_SSO_MAX 22
+
+// Big Numbers with at least this many limbs multiply by Karatsuba
+#ifndef BIG_KARATSUBA_MIN
+#define BIG_KARATSUBA_MIN 32
+#endif
+
+// Limbs in the largest whole double, which is below 2^1024
+#define LDBL_LIMBS 32
+
+// Calls a memoised function remembers unless given a capacity
+#define MEMO_DEFAULT_CAP 1024
+
+// Most literal Q-Expressions one read remembers for hash-consing
+#define LVAL_CONS_MAX 4096
+
+// Frames with at least this many bindings get a hash index
+#define LENV_INDEX_MIN 16
+
+// Nursery chunk size, in values, and the smallest old generation that
+// triggers a major collection
+#ifndef GC_NURSERY_LVALS
+#define GC_NURSERY_LVALS 65536
+#endif
+#define GC_OLD_MIN (4 * GC_NURSERY_LVALS)
+
+// Pools grow a slab at a time, and pool arrays of up to 2^10 pointers
+#define POOL_SLAB_BYTES 65536
+#define POOL_ARRAY_CLASSES 11
+#define POOL_ARRAY_MAX (1 << (POOL_ARRAY_CLASSES - 1))
+
 enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_BOOL, LVAL_STR,
-       LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR };
+       LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR, LVAL_VEC, LVAL_MAP, LVAL_BIG,
+       LVAL_FLT, LVAL_ARR, LVAL_MEMO };
+
+// Element types of a typed Array
+enum { ARR_I64, ARR_F64 };
 
 char *ltype_name(int t) {
   switch(t) {
@@ -55,14 +114,24 @@ char *ltype_name(int t) {
     case LVAL_SYM: return "Symbol";
     case LVAL_SEXPR: return "S-Expression";
     case LVAL_QEXPR: return "Q-Expression";
+    case LVAL_VEC: return "Vector";
+    case LVAL_MAP: return "Map";
+    case LVAL_BIG: return "Big Number";
+    case LVAL_FLT: return "Float";
+    case LVAL_ARR: return "Array";
+    case LVAL_MEMO: return "Memo Table";
     default: return "Unknown";
   }
 }
 
 struct lval;
 struct lenv;
+struct lcode;
+struct lmemo;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lcode lcode;
+typedef struct lmemo lmemo;
 
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
@@ -75,53 +144,127 @@ mpc_parser_t *Qexpr  ;
 mpc_parser_t *Expr   ;
 mpc_parser_t *Rosq   ;
 
-lval *lval_read_num(mpc_ast_t *t);
+lval *lval_read_num(char *s);
+lval *lval_read_cons(lval *x);
+void lval_read_cons_reset(void);
 lval *lval_read(mpc_ast_t *t);
+lval *lval_read_src(char *src, size_t n, char *filename);
+lval *lval_read_file(char *filename);
+extern int reader_mpc;
+
+unsigned long lsym_hash_n(char *s, size_t n);
+char *lsym_intern(char *s);
+char *lsym_intern_n(char *s, size_t len);
+void lsym_init(void);
+
+void pool_init(void);
+void *pool_array_alloc(int n);
+void pool_array_free(void *a, int n);
+void *pool_array_resize(void *a, int old, int n);
+
+void gc_root(lval **v);
+void gc_unroot(int n);
+void gc_root_env(lenv *e);
+void gc_unroot_env(void);
+void gc_write(lval *v);
+void gc_write_env(lenv *e);
+void gc_collect(void);
+lval *gc_stat(char *name, long x);
 
+void lenv_replace(lenv *e, lenv *next);
 lenv *lenv_new(void);
+void lenv_frame(lenv *e, lenv *par);
 void lenv_del(lenv *e);
 lval *lenv_get(lenv *e, lval *k);
 void lenv_put(lenv *e, lval *k, lval *v);
+void lenv_put_sym(lenv *e, char *sym, lval *v);
 void lenv_add_builtin(lenv *e, char *name, lbuiltin func);
 void lenv_add_builtins(lenv *e);
 void lenv_print(lenv *e);
 
 lval *lval_fun(lbuiltin func);
 lval *lval_num(long x);
+lval *lval_bool(bool truth);
 lval *lval_err(char *fmt, ...);
 lval *lval_sym(char *s);
+lval *lval_slot_sym(char *sym, int slot);
 lval *lval_sexpr(void);
 lval *lval_qexpr(void);
+lval *lval_str(char *s);
+lval *lval_str_n(char *s, int n);
+lval *lval_str_new(int n, int cap);
+lval *lval_vec(int cap);
+lval *lval_map(int slots);
+lval *lval_big(int sign, uint32_t *d, int n);
+lval *lval_flt(double x);
+lval *lval_arr(int kind, int n);
 
+lval *lval_alloc(int type);
 lval *lval_copy(lval *v);
+lval *lval_dup(lval *v);
+lval *lval_mut(lval *v);
 void lval_del(lval *v);
 lval *lval_add(lval *v, lval *x);
 void lval_expr_print(lval *v, char open, char close);
 void lval_print(lval *v);
 void lval_println(lval *v);
+void lval_vec_print(lval *v);
+void lval_map_print(lval *v);
+void lval_arr_print(lval *v);
+void lval_flt_print(double x);
 void lval_print_str(lval *v);
 int lval_eq(lval *x, lval *y);
+int lval_same(lval *x, lval *y);
+unsigned long lval_hash(lval *v);
+int lval_hashable(lval *v);
+int lval_map_find(lval *m, lval *k, unsigned long h);
+lval *lval_big_op(char op, lval *x, lval *y);
+lval *lval_big_read(char *s);
+char *lval_big_str(lval *v);
+int ldbl_limbs(double x, uint32_t *d);
+int lnum_cmp_dbl(lval *v, double f);
+int lval_num_cmp(lval *x, lval *y);
+double lval_to_dbl(lval *v);
 lval *lval_join(lval *x , lval *y);
+lval *lval_str_join(lval *x, lval *y);
+lval *lval_str_slice(lval *v, int i, int n);
+int lval_unescape(char *dst, char *src, int n);
 lval *lval_pop(lval *v, int i);
+lval *lval_slice(lval *v, int i, int n);
 lval *lval_take(lval *v, int i);
 lval *lval_eval_sexpr(lenv *e, lval *v);
 lval *lval_eval(lenv *e, lval *v);
 lval *lval_call(lenv *e, lval *f, lval *a);
+lval *lval_memo_call(lenv *e, lval *f, lval *a);
+lmemo *lmemo_new(int cap);
+void lmemo_del(lmemo *m);
+lval *lval_bind(lenv *frame, lval *f, lval *a);
+lval *lval_walk(lenv *e, lval *body);
+extern int walk_tail;
+lval *lval_run(lenv *frame, lval *body);
+lval *lval_resolve(lval *body, lval *formals);
+
+lcode *lcode_compile(lval *body);
+void lcode_del(lcode *c);
+lval *vm_run(lenv *e, lval *body);
+extern int vm_enabled;
+extern unsigned long lenv_version;
+extern lval **vm_stack;
+extern int vm_sp;
 
 lval *builtin_load(lenv *e, lval *a);
 lval *builtin_print(lenv *e, lval *a);
 lval *builtin_error(lenv *e, lval *a);
+lval *builtin_substr(lenv *e, lval *a);
 
 lval *builtin_if(lenv *e, lval *a);
 lval *builtin_and(lenv *e, lval *a);
 lval *builtin_or(lenv *e, lval *a);
 lval *builtin_not(lenv *e, lval *a);
 
-lval *builtin_cmp(lenv *e, lval *a, char *op);
 lval *builtin_eq(lenv *e, lval *a);
 lval *builtin_ne(lenv *e, lval *a);
 
-lval *builtin_ord (lenv *e, lval *a, char *op);
 lval *builtin_lt(lenv *e, lval *a);
 lval *builtin_lte(lenv *e, lval *a);
 lval *builtin_gt(lenv *e, lval *a);
@@ -139,10 +282,73 @@ lval *builtin_list(lenv *e, lval *a);
 lval *builtin_join(lenv *e, lval *a);
 lval *builtin_cons(lenv *e, lval *a);
 lval *builtin_eval(lenv *e, lval *a);
-lval *builtin_op(lenv *e, lval *a, char *op);
+
+lval *builtin_nth(lenv *e, lval *a);
+lval *builtin_last(lenv *e, lval *a);
+lval *builtin_map(lenv *e, lval *a);
+lval *builtin_filter(lenv *e, lval *a);
+lval *builtin_reverse(lenv *e, lval *a);
+lval *builtin_foldl(lenv *e, lval *a);
+lval *builtin_foldr(lenv *e, lval *a);
+lval *builtin_take(lenv *e, lval *a);
+lval *builtin_drop(lenv *e, lval *a);
+lval *builtin_elem(lenv *e, lval *a);
+lval *builtin_lookup(lenv *e, lval *a);
+lval *builtin_zip(lenv *e, lval *a);
+lval *builtin_unzip(lenv *e, lval *a);
+
+lval *builtin_vec(lenv *e, lval *a);
+lval *builtin_vmake(lenv *e, lval *a);
+lval *builtin_vlist(lenv *e, lval *a);
+lval *builtin_vlen(lenv *e, lval *a);
+lval *builtin_vget(lenv *e, lval *a);
+lval *builtin_vset(lenv *e, lval *a);
+lval *builtin_vpush(lenv *e, lval *a);
+lval *builtin_vslice(lenv *e, lval *a);
+lval *builtin_vconcat(lenv *e, lval *a);
+
+lval *builtin_hmap(lenv *e, lval *a);
+lval *builtin_hsetof(lenv *e, lval *a);
+lval *builtin_hget(lenv *e, lval *a);
+lval *builtin_hhas(lenv *e, lval *a);
+lval *builtin_hset(lenv *e, lval *a);
+lval *builtin_hdel(lenv *e, lval *a);
+lval *builtin_hkeys(lenv *e, lval *a);
+lval *builtin_hvals(lenv *e, lval *a);
+lval *builtin_hsize(lenv *e, lval *a);
+lval *builtin_hunion(lenv *e, lval *a);
+lval *builtin_hinter(lenv *e, lval *a);
+lval *builtin_hdiff(lenv *e, lval *a);
+
+lval *builtin_memoised(lenv *e, lval *a);
+lval *builtin_memo(lenv *e, lval *a);
+lval *builtin_memostats(lenv *e, lval *a);
+
+lval *builtin_arr(lenv *e, lval *a);
+lval *builtin_farr(lenv *e, lval *a);
+lval *builtin_arange(lenv *e, lval *a);
+lval *builtin_alist(lenv *e, lval *a);
+lval *builtin_alen(lenv *e, lval *a);
+lval *builtin_aget(lenv *e, lval *a);
+lval *builtin_aadd(lenv *e, lval *a);
+lval *builtin_asub(lenv *e, lval *a);
+lval *builtin_amul(lenv *e, lval *a);
+lval *builtin_asum(lenv *e, lval *a);
+lval *builtin_amin(lenv *e, lval *a);
+lval *builtin_amax(lenv *e, lval *a);
+lval *builtin_adot(lenv *e, lval *a);
+lval *builtin_alt(lenv *e, lval *a);
+lval *builtin_agt(lenv *e, lval *a);
+lval *builtin_ale(lenv *e, lval *a);
+lval *builtin_age(lenv *e, lval *a);
+lval *builtin_aeq(lenv *e, lval *a);
+lval *lval_num_op(lval *a, char op, int i, long x);
+lval *lval_fix_call(lbuiltin f, lval *x, lval *y);
 lval *builtin_add(lenv *e, lval *a);
 lval *builtin_sub(lenv *e, lval *a);
 lval *builtin_mul(lenv *e, lval *a);
 lval *builtin_div(lenv *e, lval *a);
 lval *builtin_env(lenv *e, lval *a);
+lval *builtin_gc(lenv *e, lval *a);
+lval *builtin_pools(lenv *e, lval *a);
 lval *builtin_exit();